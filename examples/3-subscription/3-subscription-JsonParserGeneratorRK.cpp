@@ -26,7 +26,8 @@ void subscriptionHandler(const char *event, const char *data) {
 	
 	jsonParser.addChunkedData(event, data);
 
-	if (jsonParser.parse()) {
+	// parseIncremental only scans the data added since the last call
+	if (jsonParser.parseIncremental()) {
 		// Looks valid (we received all parts)
 
 		// This printing thing is just for testing purposes, you should use the commands to
@@ -2,8 +2,21 @@
 #include "Particle.h"
 #include "JsonParserGeneratorRK.h"
 
+#include <limits.h>
+#include <math.h>
+
+// The string scanners in jsmn_parse and JsonWriter::insertString use SIMD instructions when they
+// are available (Linux and Mac hosts). Define JSMN_NO_SIMD to always use the portable version.
+#ifndef JSMN_NO_SIMD
+# if defined(__AVX2__) || defined(__SSE2__)
+#  include <immintrin.h>
+# elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+# endif
+#endif
+
 
-JsonBuffer::JsonBuffer()  : buffer(0), bufferLen(0), offset(0), staticBuffers(false) {
+JsonBuffer::JsonBuffer()  : buffer(0), bufferLen(0), offset(0), maxBufferLen(0), chunksReceived(0), finalChunk(-1), staticBuffers(false) {
 
 }
 JsonBuffer::~JsonBuffer() {
@@ -12,7 +25,7 @@ JsonBuffer::~JsonBuffer() {
 	}
 }
 
-JsonBuffer::JsonBuffer(char *buffer, size_t bufferLen)  : buffer(buffer), bufferLen(bufferLen), offset(0), staticBuffers(true) {
+JsonBuffer::JsonBuffer(char *buffer, size_t bufferLen)  : buffer(buffer), bufferLen(bufferLen), offset(0), maxBufferLen(0), chunksReceived(0), finalChunk(-1), staticBuffers(true) {
 
 }
 
@@ -23,7 +36,7 @@ void JsonBuffer::setBuffer(char *buffer, size_t bufferLen) {
 }
 
 bool JsonBuffer::allocate(size_t len) {
-	if (!staticBuffers) {
+	if (!staticBuffers && (maxBufferLen == 0 || len <= maxBufferLen)) {
 		char *newBuffer;
 		if (buffer) {
 			newBuffer = (char *) realloc(buffer, len);
@@ -45,12 +58,40 @@ bool JsonBuffer::allocate(size_t len) {
 	}
 }
 
+bool JsonBuffer::reserve(size_t len) {
+	if (buffer && len <= bufferLen) {
+		return true;
+	}
+	return allocate(len);
+}
+
+void JsonBuffer::shrinkToFit() {
+	if (!staticBuffers && buffer && offset + 1 < bufferLen) {
+		allocate(offset + 1);
+	}
+}
+
+bool JsonBuffer::grow(size_t len) {
+	if (buffer && len <= bufferLen) {
+		return true;
+	}
+
+	size_t newLen = bufferLen * 2;
+	if (newLen < MIN_HEAP_BUFFER) {
+		newLen = MIN_HEAP_BUFFER;
+	}
+	if (newLen < len) {
+		newLen = len;
+	}
+	if (maxBufferLen != 0 && newLen > maxBufferLen && len <= maxBufferLen) {
+		newLen = maxBufferLen;
+	}
+	return allocate(newLen);
+}
+
 bool JsonBuffer::addData(const char *data, size_t dataLen) {
-	if (!buffer || (offset + dataLen) > bufferLen) {
-		// Need to allocate more space for data
-		if (!allocate(offset + dataLen)) {
-			return false;
-		}
+	if (!grow(offset + dataLen)) {
+		return false;
 	}
 
 	memcpy(&buffer[offset], data, dataLen);
@@ -75,17 +116,41 @@ bool JsonBuffer::addChunkedData(const char *event, const char *data, size_t chun
 	size_t len = strlen(data);
 
 	// Assumption: len will be chunkSize (512 bytes), except for the last chunk which
-	// can be smaller.
-	size_t curOffset = responseIndex * chunkSize;
-	if (!buffer || (curOffset + len) > bufferLen) {
-		// Need to allocate more space for data
-		if (!allocate(curOffset + len)) {
+	// can be smaller. Chunks that don't fit that are rejected instead of being stored
+	// at the wrong offset.
+	if (finalChunk >= 0 && responseIndex > finalChunk) {
+		// After the last chunk
+		return false;
+	}
+	if (len < chunkSize) {
+		if (finalChunk >= 0 && responseIndex != finalChunk) {
+			// Short chunk that is not the last chunk
 			return false;
 		}
+		if (responseIndex < (int)MAX_TRACKED_CHUNKS - 1 && (chunksReceived >> (responseIndex + 1)) != 0) {
+			// Short chunk before a chunk that was already received
+			return false;
+		}
+		finalChunk = responseIndex;
+	}
+
+	size_t curOffset = responseIndex * chunkSize;
+	if (!grow(curOffset + len)) {
+		return false;
+	}
+
+	if (curOffset > offset) {
+		// Chunks before this one have not arrived yet. Make sure the gap is zeroed (a heap
+		// buffer may have just been reallocated) so the parser stops there.
+		memset(&buffer[offset], 0, curOffset - offset);
 	}
 
 	memcpy(&buffer[curOffset], data, len);
 
+	if (responseIndex < (int)MAX_TRACKED_CHUNKS) {
+		chunksReceived |= (uint64_t)1 << responseIndex;
+	}
+
 	curOffset += len;
 	if (curOffset > offset) {
 		offset = curOffset;
@@ -95,11 +160,25 @@ bool JsonBuffer::addChunkedData(const char *event, const char *data, size_t chun
 }
 
 
+void JsonBuffer::setChunkCount(size_t numChunks) {
+	finalChunk = (int)numChunks - 1;
+}
+
+bool JsonBuffer::isComplete() const {
+	if (finalChunk < 0 || finalChunk >= (int)MAX_TRACKED_CHUNKS) {
+		return false;
+	}
+	// Bits 0 - finalChunk. For chunk 63 the shift wraps to 0, and 0 - 1 is all bits.
+	uint64_t allChunks = ((uint64_t)2 << finalChunk) - 1;
+	return (chunksReceived & allChunks) == allChunks;
+}
+
 void JsonBuffer::clear() {
+	// The data after offset is never read, and addChunkedData() zeroes any gap left by chunks
+	// that have not arrived yet, so the buffer does not need to be zeroed
 	offset = 0;
-	if (buffer && bufferLen) {
-		memset(buffer, 0, bufferLen);
-	}
+	chunksReceived = 0;
+	finalChunk = -1;
 }
 
 void JsonBuffer::nullTerminate() {
@@ -116,11 +195,11 @@ void JsonBuffer::nullTerminate() {
 
 //
 
-JsonParser::JsonParser() : JsonBuffer(), tokens(0), tokensEnd(0), maxTokens(0) {
+JsonParser::JsonParser() : JsonBuffer(), tokens(0), tokensEnd(0), maxTokens(0), keyIndex(0), keyIndexLen(0), keyIndexUsed(0), incrementalStarted(false) {
 }
 
 JsonParser::JsonParser(char *buffer, size_t bufferLen, JsonParserGeneratorRK::jsmntok_t *tokens, size_t maxTokens) :
-		JsonBuffer(buffer, bufferLen), tokens(tokens), maxTokens(maxTokens) {
+		JsonBuffer(buffer, bufferLen), tokens(tokens), tokensEnd(tokens), maxTokens(maxTokens), keyIndex(0), keyIndexLen(0), keyIndexUsed(0), incrementalStarted(false) {
 
 }
 
@@ -135,13 +214,14 @@ bool JsonParser::allocateTokens(size_t maxTokens) {
 	if (!staticBuffers) {
 		JsonParserGeneratorRK::jsmntok_t *newTokens;
 		if (tokens) {
-			newTokens = (JsonParserGeneratorRK::jsmntok_t *)realloc(buffer, sizeof(JsonParserGeneratorRK::jsmntok_t) * maxTokens);
+			newTokens = (JsonParserGeneratorRK::jsmntok_t *)realloc(tokens, sizeof(JsonParserGeneratorRK::jsmntok_t) * maxTokens);
 		}
 		else {
 			newTokens = (JsonParserGeneratorRK::jsmntok_t *)malloc(sizeof(JsonParserGeneratorRK::jsmntok_t) * maxTokens);
 		}
 		if (newTokens) {
 			tokens = newTokens;
+			tokensEnd = tokens;
 			this->maxTokens = maxTokens;
 			return true;
 		}
@@ -154,6 +234,15 @@ bool JsonParser::allocateTokens(size_t maxTokens) {
 	}
 }
 
+bool JsonParser::growTokens() {
+	// Grow geometrically so a document of n tokens only causes O(log n) reallocations
+	size_t newMaxTokens = maxTokens * 2;
+	if (newMaxTokens < MIN_HEAP_TOKENS) {
+		newMaxTokens = MIN_HEAP_TOKENS;
+	}
+	return allocateTokens(newMaxTokens);
+}
+
 bool JsonParser::parse() {
 	if (offset == 0) {
 		// If addString or addData is not called, or called with an empty string,
@@ -161,63 +250,147 @@ bool JsonParser::parse() {
 		return false;
 	}
 
-	if (tokens) {
-		// Try to use the existing token buffer if possible
-		JsonParserGeneratorRK::jsmn_init(&parser);
-		int result = JsonParserGeneratorRK::jsmn_parse(&parser, buffer, offset, tokens, maxTokens);
-		if (result == JsonParserGeneratorRK::JSMN_ERROR_NOMEM) {
-			if (staticBuffers) {
-				// If using static buffers and there is not enough space, fail
-				return false;
+	if (!tokens && !growTokens()) {
+		// jsmn_parse with a null token array only counts tokens, so there must always be one
+		return false;
+	}
+
+	JsonParserGeneratorRK::jsmn_init(&parser);
+	incrementalStarted = false;
+
+	// Token indexes from the previous parse are no longer valid
+	keyIndexUsed = 0;
+
+	int result = runParser();
+	if (result <= 0) {
+		// Failed to parse: JSMN_ERROR_INVAL or JSMN_ERROR_PART, or there was nothing but
+		// whitespace (or a null byte, such as an unfilled chunk) before any token
+		return false;
+	}
+
+	tokensEnd = &tokens[result];
+
+	/*
+	for(const JsonParserGeneratorRK::jsmntok_t *token = tokens; token < tokensEnd; token++) {
+		printf("%d, %d, %d, %d\n", token->type, token->start, token->end, token->size);
+	}
+	*/
+
+	return true;
+}
+
+bool JsonParser::parseInSitu() {
+	if (!parse()) {
+		return false;
+	}
+
+	for(JsonParserGeneratorRK::jsmntok_t *token = tokens; token < tokensEnd; token++) {
+		if (token->type == JsonParserGeneratorRK::JSMN_STRING) {
+			if (token->escaped) {
+				// Decode in place. Every escape is at least as long as what it decodes to,
+				// so the write position never passes the read position.
+				char *dst = &buffer[token->start];
+				const char *src = dst;
+				const char *srcEnd = &buffer[token->end];
+
+				while(src < srcEnd) {
+					const char *backslash = (const char *)memchr(src, '\\', srcEnd - src);
+					if (!backslash) {
+						backslash = srcEnd;
+					}
+					memmove(dst, src, backslash - src);
+					dst += backslash - src;
+					if (backslash == srcEnd) {
+						break;
+					}
+
+					char decoded[4];
+					size_t decodedLen;
+					src = decodeEscape(backslash + 1, srcEnd, decoded, decodedLen);
+					memcpy(dst, decoded, decodedLen);
+					dst += decodedLen;
+				}
+				token->end = dst - buffer;
+				token->escaped = 0;
 			}
-			free(tokens);
-			tokens = 0;
-			maxTokens = 0;
+			// Replaces the closing quote, or a byte of the escapes that were decoded
+			buffer[token->end] = 0;
 		}
 		else
-		if (result < 0) {
-			// Failed to parse: JSMN_ERROR_INVAL or JSMN_ERROR_PART
-			return false;
-		}
-		else {
-			tokensEnd = &tokens[result];
-			return true;
+		if (token->type == JsonParserGeneratorRK::JSMN_PRIMITIVE && (size_t)token->end < bufferLen) {
+			// Replaces the separator after the value, or the byte after the data
+			buffer[token->end] = 0;
 		}
 	}
 
-	// Pass 1: determine now many tokens we need
-	JsonParserGeneratorRK::jsmn_init(&parser);
-	int result = JsonParserGeneratorRK::jsmn_parse(&parser, buffer, offset, 0, 0);
-	if (result < 0) {
-		// Failed to parse: JSMN_ERROR_INVAL or JSMN_ERROR_PART
+	return true;
+}
+
+bool JsonParser::parseIncremental() {
+	if (offset == 0) {
 		return false;
 	}
 
-	// If we get here, tokens will always be == 0; it would have been freed if it was
-	// too small, and this code is never executed for staticBuffers == true
-
-	maxTokens = (size_t) result;
-	if (maxTokens > 0) {
-		tokens = (JsonParserGeneratorRK::jsmntok_t *)malloc(sizeof(JsonParserGeneratorRK::jsmntok_t) * maxTokens);
+	if (!tokens && !growTokens()) {
+		return false;
+	}
 
+	if (!incrementalStarted) {
 		JsonParserGeneratorRK::jsmn_init(&parser);
-		int result = JsonParserGeneratorRK::jsmn_parse(&parser, buffer, offset, tokens, maxTokens);
-
-		tokensEnd = &tokens[result];
+		keyIndexUsed = 0;
+		incrementalStarted = true;
+	}
+	tokensEnd = tokens;
+
+	int result = runParser();
+	if (result == JsonParserGeneratorRK::JSMN_ERROR_PART || result == 0) {
+		// jsmn_parse stopped at the end of the data or at the zeroed gap before a chunk that
+		// has not arrived yet. In non-strict mode it has already stored a token for a primitive
+		// that runs up to there, but the primitive may continue in the next chunk, so remove
+		// that token and scan the primitive again next time.
+		if (parser.toknext > 0 && parser.toksuper >= 0) {
+			JsonParserGeneratorRK::jsmntok_t *last = &tokens[parser.toknext - 1];
+			if (last->type == JsonParserGeneratorRK::JSMN_PRIMITIVE && last->end == (int)parser.pos) {
+				tokens[parser.toksuper].size--;
+				parser.pos = last->start;
+				parser.toknext--;
+			}
+		}
+		return false;
 	}
-	else {
-		tokensEnd = tokens;
+	if (result < 0) {
+		return false;
 	}
 
-	/*
-	for(const JsonParserGeneratorRK::jsmntok_t *token = tokens; token < tokensEnd; token++) {
-		printf("%d, %d, %d, %d\n", token->type, token->start, token->end, token->size);
-	}
-	*/
+	tokensEnd = &tokens[result];
 
 	return true;
 }
 
+void JsonParser::clear() {
+	JsonBuffer::clear();
+	incrementalStarted = false;
+}
+
+int JsonParser::runParser() {
+	int result;
+	while(true) {
+		result = JsonParserGeneratorRK::jsmn_parse(&parser, buffer, offset, tokens, maxTokens);
+		if (result != JsonParserGeneratorRK::JSMN_ERROR_NOMEM) {
+			break;
+		}
+
+		// Out of tokens. jsmn_parse leaves the parser at the value it could not store, so
+		// after growing the token array it picks up from there instead of starting over.
+		// The token array is not shrunk afterwards so later parse() calls can reuse it.
+		if (staticBuffers || !growTokens()) {
+			// If using static buffers and there is not enough space, fail
+			break;
+		}
+	}
+	return result;
+}
+
 JsonReference JsonParser::getReference() const {
 
 	if (tokens < tokensEnd) {
@@ -274,10 +447,7 @@ const JsonParserGeneratorRK::jsmntok_t *JsonParser::getOuterToken() const {
 
 
 bool JsonParser::skipObject(const JsonParserGeneratorRK::jsmntok_t *container, const JsonParserGeneratorRK::jsmntok_t *&obj) const {
-	int curObjectEnd = obj->end;
-
-	while(++obj < tokensEnd && obj->end < container->end && obj->end <= curObjectEnd) {
-	}
+	obj += obj->extent;
 
 	if (obj >= tokensEnd || obj->end > container->end) {
 		// No object after index
@@ -310,17 +480,170 @@ bool JsonParser::getKeyValueTokenByIndex(const JsonParserGeneratorRK::jsmntok_t
 
 bool JsonParser::getValueTokenByKey(const JsonParserGeneratorRK::jsmntok_t *container, const char *name, const JsonParserGeneratorRK::jsmntok_t *&value) const {
 
-	const JsonParserGeneratorRK::jsmntok_t *key;
-	String keyName;
+	size_t nameLen = strlen(name);
+
+	if (keyIndex && container->type == JsonParserGeneratorRK::JSMN_OBJECT && container->size >= KEY_INDEX_MIN_KEYS) {
+		const int32_t *index = getKeyIndex(container);
+		if (index) {
+			size_t mask = (size_t)index[1] - 1;
+			const int32_t *slots = &index[2];
+
+			for(size_t slot = hashKey(name, nameLen) & mask; slots[slot]; slot = (slot + 1) & mask) {
+				const JsonParserGeneratorRK::jsmntok_t *key = &tokens[slots[slot]];
+				if (tokenEquals(key, name, nameLen)) {
+					// A key without a value is the last token in the container
+					const JsonParserGeneratorRK::jsmntok_t *token = key;
+					if (!skipObject(container, token)) {
+						return false;
+					}
+					value = token;
+					return true;
+				}
+			}
+			return false;
+		}
+	}
+
+	const JsonParserGeneratorRK::jsmntok_t *token = container + 1;
 
-	for(size_t ii = 0; getKeyValueTokenByIndex(container, key, value, ii); ii++) {
-		if (getTokenValue(key, keyName) && keyName == name) {
+	// Walk the key/value pairs once, comparing keys in place in the buffer
+	while(token < tokensEnd && token->end < container->end) {
+		const JsonParserGeneratorRK::jsmntok_t *key = token;
+		if (!skipObject(container, token)) {
+			break;
+		}
+		if (tokenEquals(key, name, nameLen)) {
+			value = token;
 			return true;
 		}
+		skipObject(container, token);
 	}
 	return false;
 }
 
+bool JsonParser::tokenEquals(const JsonParserGeneratorRK::jsmntok_t *token, const char *str, size_t strLen) const {
+	const char *src = &buffer[token->start];
+	const char *srcEnd = &buffer[token->end];
+
+	if (!tokenHasEscapes(token)) {
+		// No escapes, so the bytes in the buffer are the value
+		return (size_t)(srcEnd - src) == strLen && memcmp(src, str, strLen) == 0;
+	}
+
+	// Compare while decoding escapes
+	const char *strEnd = str + strLen;
+	while(src < srcEnd) {
+		if (*src == '\\') {
+			char decoded[3];
+			size_t decodedLen;
+			src = decodeEscape(src + 1, srcEnd, decoded, decodedLen);
+			if ((size_t)(strEnd - str) < decodedLen || memcmp(str, decoded, decodedLen) != 0) {
+				return false;
+			}
+			str += decodedLen;
+		}
+		else {
+			if (str == strEnd || *str != *src) {
+				return false;
+			}
+			str++;
+			src++;
+		}
+	}
+	return str == strEnd;
+}
+
+void JsonParser::setKeyIndexBuffer(int32_t *keyIndex, size_t keyIndexLen) {
+	this->keyIndex = keyIndex;
+	this->keyIndexLen = keyIndexLen;
+	this->keyIndexUsed = 0;
+}
+
+const int32_t *JsonParser::getKeyIndex(const JsonParserGeneratorRK::jsmntok_t *container) const {
+	int32_t containerIndex = container - tokens;
+
+	// Each index is the container token index, the number of slots, then the slots
+	for(size_t ii = 0; ii < keyIndexUsed; ii += 2 + keyIndex[ii + 1]) {
+		if (keyIndex[ii] == containerIndex) {
+			return &keyIndex[ii];
+		}
+	}
+
+	// Not indexed yet. Use a power of 2 number of slots at least twice the number of keys
+	// so probe sequences stay short.
+	size_t numSlots = 1;
+	while(numSlots < (size_t)container->size * 2) {
+		numSlots <<= 1;
+	}
+	if (keyIndexUsed + 2 + numSlots > keyIndexLen) {
+		// Not enough space left in the index buffer, use a linear search instead
+		return 0;
+	}
+
+	int32_t *index = &keyIndex[keyIndexUsed];
+	index[0] = containerIndex;
+	index[1] = (int32_t) numSlots;
+
+	int32_t *slots = &index[2];
+	memset(slots, 0, numSlots * sizeof(int32_t));
+
+	// Keys are inserted in order, so with linear probing the first of duplicate keys
+	// is found first, the same as a linear search.
+	const JsonParserGeneratorRK::jsmntok_t *token = container + 1;
+	while(token < tokensEnd && token->end < container->end) {
+		size_t slot = hashToken(token) & (numSlots - 1);
+		while(slots[slot]) {
+			slot = (slot + 1) & (numSlots - 1);
+		}
+		slots[slot] = token - tokens;
+
+		if (!skipObject(container, token)) {
+			break;
+		}
+		skipObject(container, token);
+	}
+	keyIndexUsed += 2 + numSlots;
+
+	return index;
+}
+
+// [static]
+uint32_t JsonParser::hashKey(const char *str, size_t strLen, uint32_t hash) {
+	// FNV-1a
+	for(size_t ii = 0; ii < strLen; ii++) {
+		hash = (hash ^ (uint8_t)str[ii]) * 16777619;
+	}
+	return hash;
+}
+
+uint32_t JsonParser::hashToken(const JsonParserGeneratorRK::jsmntok_t *token) const {
+	const char *src = &buffer[token->start];
+	const char *srcEnd = &buffer[token->end];
+
+	// Hash the decoded value so it matches hashKey() on the unescaped key name
+	uint32_t hash = HASH_KEY_INITIAL;
+	if (!tokenHasEscapes(token)) {
+		return hashKey(src, srcEnd - src, hash);
+	}
+	while(src < srcEnd) {
+		const char *backslash = (const char *)memchr(src, '\\', srcEnd - src);
+		if (!backslash) {
+			backslash = srcEnd;
+		}
+		hash = hashKey(src, backslash - src, hash);
+		if (backslash < srcEnd) {
+			char decoded[3];
+			size_t decodedLen;
+			src = decodeEscape(backslash + 1, srcEnd, decoded, decodedLen);
+			hash = hashKey(decoded, decodedLen, hash);
+		}
+		else {
+			src = srcEnd;
+		}
+	}
+	return hash;
+}
+
 bool JsonParser::getValueTokenByIndex(const JsonParserGeneratorRK::jsmntok_t *container, size_t desiredIndex, const JsonParserGeneratorRK::jsmntok_t *&value) const {
 	size_t index = 0;
 	const JsonParserGeneratorRK::jsmntok_t *token = container + 1;
@@ -352,6 +675,11 @@ bool JsonParser::getValueTokenByColRow(const JsonParserGeneratorRK::jsmntok_t *c
 
 
 size_t JsonParser::getArraySize(const JsonParserGeneratorRK::jsmntok_t *arrayContainer) const {
+	if (arrayContainer->type == JsonParserGeneratorRK::JSMN_ARRAY) {
+		// The tokenizer counts the elements of an array as it parses
+		return arrayContainer->size;
+	}
+
 	size_t index = 0;
 	const JsonParserGeneratorRK::jsmntok_t *token = arrayContainer + 1;
 
@@ -396,53 +724,207 @@ bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, bo
 	}
 }
 
-bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, int &result) const {
-	// Copy data here, because tokens are not null terminated
-	char tmp[16];
-	copyTokenValue(token, tmp, sizeof(tmp));
+// Number parsing helpers for the getTokenValue() overloads. These read directly from the token
+// in the buffer and don't depend on the locale.
 
-	if (sscanf(tmp, "%d", &result) == 1) {
-		return true;
+// Skips leading whitespace and an optional sign. Returns true if the sign was a minus.
+static bool scanSign(const char *&cur, const char *end) {
+	while(cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n')) {
+		cur++;
 	}
-	else {
-		return false;
+	if (cur < end && (*cur == '-' || *cur == '+')) {
+		return *cur++ == '-';
 	}
+	return false;
 }
 
-bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, unsigned long &result) const {
-	// Copy data here, because tokens are not null terminated
-	char tmp[16];
-	copyTokenValue(token, tmp, sizeof(tmp));
+// Parses decimal digits up to the first non-digit. Fails if there are no digits or the value
+// is larger than maxValue.
+static bool scanUnsigned(const char *cur, const char *end, unsigned long long maxValue, unsigned long long &result) {
+	const char *start = cur;
 
-	if (sscanf(tmp, "%lu", &result) == 1) {
-		return true;
+	result = 0;
+	for(; cur < end && *cur >= '0' && *cur <= '9'; cur++) {
+		unsigned digit = *cur - '0';
+		if (result > (maxValue - digit) / 10) {
+			// Overflow
+			return false;
+		}
+		result = result * 10 + digit;
+	}
+	return cur > start;
+}
+
+// Parses a JSON number into a decimal mantissa and power of 10, stopping at the first character
+// that's not part of the number. Fails if there are no digits or more than 19 significant digits,
+// which don't fit in the mantissa.
+static bool scanDecimal(const char *cur, const char *end, bool &negative, uint64_t &mantissa, int &exp10) {
+	negative = scanSign(cur, end);
+	mantissa = 0;
+	exp10 = 0;
+
+	int sigDigits = 0;
+	bool anyDigits = false;
+	bool inFraction = false;
+	for(; cur < end; cur++) {
+		if (*cur >= '0' && *cur <= '9') {
+			anyDigits = true;
+			if (mantissa != 0 || *cur != '0') {
+				if (++sigDigits > 19) {
+					return false;
+				}
+			}
+			mantissa = mantissa * 10 + (*cur - '0');
+			if (inFraction) {
+				exp10--;
+			}
+		}
+		else
+		if (*cur == '.' && !inFraction) {
+			inFraction = true;
+		}
+		else {
+			break;
+		}
 	}
-	else {
+	if (!anyDigits) {
 		return false;
 	}
+
+	if (cur < end && (*cur == 'e' || *cur == 'E')) {
+		const char *expCur = cur + 1;
+		bool expNegative = false;
+		if (expCur < end && (*expCur == '-' || *expCur == '+')) {
+			expNegative = (*expCur++ == '-');
+		}
+		unsigned long long expValue;
+		if (scanUnsigned(expCur, end, 100000, expValue)) {
+			exp10 += expNegative ? -(int)expValue : (int)expValue;
+		}
+		else
+		if (expCur < end && *expCur >= '0' && *expCur <= '9') {
+			// Exponent too large, let strtod deal with it
+			return false;
+		}
+	}
+	return true;
 }
 
+// strtod and strtof need a null-terminated string. When the token ends inside the data the next
+// byte is always a quote, comma, bracket, or whitespace, so they can parse in place. Otherwise
+// the number is copied to the stack.
+bool JsonParser::parseTokenWithStrtod(const JsonParserGeneratorRK::jsmntok_t *token, double *doubleResult, float *floatResult) const {
+	const char *str = &buffer[token->start];
+	char tmp[64];
+
+	if ((size_t)token->end >= offset) {
+		size_t len = token->end - token->start;
+		if (len >= sizeof(tmp)) {
+			return false;
+		}
+		memcpy(tmp, str, len);
+		tmp[len] = 0;
+		str = tmp;
+	}
+
+	// Values out of range return infinity, which is not a valid result
+	char *numEnd;
+	if (doubleResult) {
+		*doubleResult = strtod(str, &numEnd);
+		return numEnd > str && !isinf(*doubleResult);
+	}
+	else {
+		*floatResult = strtof(str, &numEnd);
+		return numEnd > str && !isinf(*floatResult);
+	}
+}
 
+bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, int &result) const {
+	const char *cur = &buffer[token->start];
+	const char *end = &buffer[token->end];
 
-bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, float &result) const {
-	// Copy data here, because tokens are not null terminated
-	char tmp[16];
-	copyTokenValue(token, tmp, sizeof(tmp));
+	bool negative = scanSign(cur, end);
 
-	result = strtof(tmp, 0);
+	unsigned long long value;
+	if (!scanUnsigned(cur, end, negative ? (unsigned long long)INT_MAX + 1 : INT_MAX, value)) {
+		return false;
+	}
+	result = negative ? (int)(-(long long)value) : (int)value;
 	return true;
 }
 
-bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, double &result) const {
-	// Copy data here, because tokens are not null terminated
-	char tmp[16];
-	copyTokenValue(token, tmp, sizeof(tmp));
+bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, unsigned long &result) const {
+	const char *cur = &buffer[token->start];
+	const char *end = &buffer[token->end];
+
+	if (scanSign(cur, end)) {
+		// Negative numbers are not valid unsigned values
+		return false;
+	}
 
-	result = strtod(tmp, 0);
+	unsigned long long value;
+	if (!scanUnsigned(cur, end, ULONG_MAX, value)) {
+		return false;
+	}
+	result = (unsigned long)value;
 	return true;
 }
 
+bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, float &result) const {
+	static const float powersOf10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+	bool negative;
+	uint64_t mantissa;
+	int exp10;
+	if (scanDecimal(&buffer[token->start], &buffer[token->end], negative, mantissa, exp10)) {
+		// Fast path (Clinger): the mantissa and power of 10 are both exactly representable,
+		// so a single multiply or divide gives the correctly rounded result
+		if (mantissa <= (1UL << 24) && exp10 >= -10 && exp10 <= 10) {
+			result = (float)mantissa;
+			result = (exp10 < 0) ? (result / powersOf10[-exp10]) : (result * powersOf10[exp10]);
+			if (negative) {
+				result = -result;
+			}
+			return true;
+		}
+	}
+
+	return parseTokenWithStrtod(token, 0, &result);
+}
+
+bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, double &result) const {
+	static const double powersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const uint64_t maxExactMantissa = 1ULL << 53;
+
+	bool negative;
+	uint64_t mantissa;
+	int exp10;
+	if (scanDecimal(&buffer[token->start], &buffer[token->end], negative, mantissa, exp10)) {
+		// Large exponents can still use the fast path if the extra powers of 10 fit in the mantissa,
+		// for example 12e30 is 12000000e25
+		while(exp10 > 22 && mantissa < maxExactMantissa / 10) {
+			mantissa *= 10;
+			exp10--;
+		}
+
+		// Fast path (Clinger): the mantissa and power of 10 are both exactly representable,
+		// so a single multiply or divide gives the correctly rounded result
+		if (mantissa <= maxExactMantissa && exp10 >= -22 && exp10 <= 22) {
+			result = (double)mantissa;
+			result = (exp10 < 0) ? (result / powersOf10[-exp10]) : (result * powersOf10[exp10]);
+			if (negative) {
+				result = -result;
+			}
+			return true;
+		}
+	}
 
+	// Long mantissas and very large or small exponents fall back to strtod, which is exact
+	return parseTokenWithStrtod(token, &result, 0);
+}
 
 bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, String &result) const {
 
@@ -462,65 +944,53 @@ bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, ch
 
 
 bool JsonParser::getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, JsonParserString &str) const {
+	const char *src = &buffer[token->start];
+	const char *srcEnd = &buffer[token->end];
 
-	int unicode;
-	bool escape = false;
-
-	for(int ii = token->start; ii < token->end; ii++) {
-		if (escape) {
-			escape = false;
-			switch(buffer[ii]) {
-			case 'b':
-				str.append('\b');
-				break;
-
-			case 'f':
-				str.append('\f');
-				break;
+	if (!tokenHasEscapes(token)) {
+		str.append(src, srcEnd - src);
+		return true;
+	}
 
-			case 'n':
-				str.append('\n');
-				break;
+	while(src < srcEnd) {
+		// Append everything up to the next backslash at once
+		const char *backslash = (const char *)memchr(src, '\\', srcEnd - src);
+		if (!backslash) {
+			str.append(src, srcEnd - src);
+			break;
+		}
+		str.append(src, backslash - src);
 
-			case 'r':
-				str.append('\r');
-				break;
+		char decoded[4];
+		size_t decodedLen;
+		src = decodeEscape(backslash + 1, srcEnd, decoded, decodedLen);
+		str.append(decoded, decodedLen);
+	}
 
-			case 't':
-				str.append('\t');
-				break;
+	return true;
+}
 
-			case 'u':
-				if ((ii + 4) < token->end) {
-					// Copy data here because buffer is not null terminated and this could
-					// read past the end otherwise
-					char tmp[5];
-					for(size_t jj = 0; jj < 4; jj++) {
-						tmp[jj] = buffer[ii + jj + 1];
-					}
-					tmp[4] = 0;
-					if (sscanf(tmp, "%04x", &unicode) == 1) {
-						appendUtf8((uint16_t)unicode, str);
-						ii += 5; // also increments in loop
-					}
-				}
-				break;
-
-			default:
-				str.append(buffer[ii]);
-				break;
-			}
-		}
-		else
-		if (buffer[ii] == '\\') {
-			escape = true;
-		}
-		else {
-			str.append(buffer[ii]);
-		}
+const char *JsonParser::getTokenCString(const JsonParserGeneratorRK::jsmntok_t *token) const {
+	if ((size_t)token->end < bufferLen && buffer[token->end] == 0) {
+		return &buffer[token->start];
+	}
+	else {
+		return NULL;
 	}
+}
 
-	return true;
+bool JsonParser::getTokenView(const JsonParserGeneratorRK::jsmntok_t *token, const char *&str, size_t &strLen) const {
+	str = &buffer[token->start];
+	strLen = token->end - token->start;
+	return !tokenHasEscapes(token);
+}
+
+bool JsonParser::tokenHasEscapes(const JsonParserGeneratorRK::jsmntok_t *token) const {
+	if (token->type == JsonParserGeneratorRK::JSMN_STRING) {
+		return token->escaped;
+	}
+	// The tokenizer only flags strings; non-strict primitives could still contain a backslash
+	return memchr(&buffer[token->start], '\\', token->end - token->start) != 0;
 }
 
 bool JsonParser::getTokenJsonString(const JsonParserGeneratorRK::jsmntok_t *token, String &result) const {
@@ -546,36 +1016,102 @@ bool JsonParser::getTokenJsonString(const JsonParserGeneratorRK::jsmntok_t *toke
 
 // [static]
 void JsonParser::appendUtf8(uint16_t unicode, JsonParserString &str) {
+	char utf8[3];
+
+	size_t len = encodeUtf8(unicode, utf8);
+	for(size_t ii = 0; ii < len; ii++) {
+		str.append(utf8[ii]);
+	}
+}
 
-	unsigned char value;
+// [static]
+size_t JsonParser::encodeUtf8(uint16_t unicode, char *dst) {
 
 	if (unicode <= 0x007f) {
 		// 0x00000000 - 0x0000007F:
-		str.append((char)unicode);
+		dst[0] = (char)unicode;
+		return 1;
 	}
 	else
 	if (unicode <= 0x7ff) {
 		// 0x00000080 - 0x000007FF:
 		// 110xxxxx 10xxxxxx
-
-		value = (0b11000000 | ((unicode >> 6) & 0b11111));
-		str.append((char)value);
-
-		value = (0b10000000 | (unicode & 0b111111));
-		str.append((char)value);
+		dst[0] = (char)(0b11000000 | ((unicode >> 6) & 0b11111));
+		dst[1] = (char)(0b10000000 | (unicode & 0b111111));
+		return 2;
 	}
 	else {
 		// 0x00000800 - 0x0000FFFF:
 		// 1110xxxx 10xxxxxx 10xxxxxx
-		value = 0b11100000 | ((unicode >> 12) & 0b1111);
-		str.append((char)value);
+		dst[0] = (char)(0b11100000 | ((unicode >> 12) & 0b1111));
+		dst[1] = (char)(0b10000000 | ((unicode >> 6) & 0b111111));
+		dst[2] = (char)(0b10000000 | (unicode & 0b111111));
+		return 3;
+	}
+}
 
-		value = 0b10000000 | ((unicode >> 6) & 0b111111);
-		str.append((char)value);
+// [static]
+const char *JsonParser::decodeEscape(const char *src, const char *srcEnd, char *dst, size_t &dstLen) {
+	if (src >= srcEnd) {
+		dstLen = 0;
+		return src;
+	}
+
+	switch(*src) {
+	case 'b':
+		dst[0] = '\b';
+		break;
+
+	case 'f':
+		dst[0] = '\f';
+		break;
+
+	case 'n':
+		dst[0] = '\n';
+		break;
+
+	case 'r':
+		dst[0] = '\r';
+		break;
+
+	case 't':
+		dst[0] = '\t';
+		break;
+
+	case 'u': {
+		// Values of the characters '0' to 'f', or -1 if not a hex digit
+		static const int8_t hexValues['f' - '0' + 1] = {
+			0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1, -1, -1, -1, -1, -1,
+			-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, 10, 11, 12, 13, 14, 15
+		};
+		if ((srcEnd - src) > 4) {
+			uint16_t unicode = 0;
+			int valid = 0;
+			for(size_t ii = 1; ii <= 4; ii++) {
+				uint8_t index = (uint8_t)(src[ii] - '0');
+				int value = (index < sizeof(hexValues)) ? hexValues[index] : -1;
+				valid |= value;
+				unicode = (uint16_t)((unicode << 4) | (value & 0xf));
+			}
+			if (valid >= 0) {
+				dstLen = encodeUtf8((uint16_t)unicode, dst);
+				return src + 5;
+			}
+		}
+		// Not a valid Unicode escape, skip the u
+		dstLen = 0;
+		return src + 1;
+	}
 
-		value = 0b10000000 | (unicode & 0b111111);
-		str.append((char)value);
+	default:
+		// \" \\ \/ and anything else is the character itself
+		dst[0] = *src;
+		break;
 	}
+	dstLen = 1;
+	return src + 1;
 }
 
 //
@@ -655,6 +1191,144 @@ String JsonReference::valueString() const {
 	return result;
 }
 
+const char *JsonReference::valueCString(const char *defaultValue) const {
+	const char *result = token ? parser->getTokenCString(token) : NULL;
+	return result ? result : defaultValue;
+}
+
+bool JsonReference::valueView(const char *&str, size_t &strLen) const {
+	return token && parser->getTokenView(token, str, strLen);
+}
+
+
+//
+//
+//
+JsonChunkReassembler::JsonChunkReassembler(size_t maxResponses, size_t maxBufferLen) :
+		responses(new Response[maxResponses]), numResponses(maxResponses), maxBufferLen(maxBufferLen), staticResponses(false), timeoutMs(DEFAULT_TIMEOUT_MS) {
+	for(size_t ii = 0; ii < numResponses; ii++) {
+		responses[ii].parser = NULL;
+		responses[ii].inUse = false;
+	}
+}
+
+JsonChunkReassembler::JsonChunkReassembler(Response *responses, size_t numResponses) :
+		responses(responses), numResponses(numResponses), maxBufferLen(0), staticResponses(true), timeoutMs(DEFAULT_TIMEOUT_MS) {
+	for(size_t ii = 0; ii < numResponses; ii++) {
+		responses[ii].inUse = false;
+	}
+}
+
+JsonChunkReassembler::~JsonChunkReassembler() {
+	if (!staticResponses) {
+		for(size_t ii = 0; ii < numResponses; ii++) {
+			delete responses[ii].parser;
+		}
+		delete[] responses;
+	}
+}
+
+bool JsonChunkReassembler::addChunkedData(const char *event, const char *data, size_t chunkSize) {
+	// The response is identified by the event name without the chunk number
+	const char *slashOffset = strrchr(event, '/');
+	size_t eventNameLen = slashOffset ? (size_t)(slashOffset - event) : strlen(event);
+	if (eventNameLen > MAX_EVENT_NAME) {
+		return false;
+	}
+
+	loop();
+
+	Response *response = findResponse(event, eventNameLen);
+	if (!response) {
+		return false;
+	}
+	response->lastChunkMillis = millis();
+
+	JsonParser *parser = response->parser;
+	if (!parser->addChunkedData(event, data, chunkSize)) {
+		// Doesn't fit with the chunks already received, or out of memory
+		releaseResponse(response);
+		return false;
+	}
+
+	// parseIncremental only tokenizes the data added since the last call. It stops at the gap
+	// left by a chunk that has not arrived yet, and returns true once the outer object or array
+	// is complete.
+	if (parser->parseIncremental()) {
+		if (completionCallback) {
+			completionCallback(response->eventName, *parser);
+		}
+		releaseResponse(response);
+	}
+	else
+	if (parser->isComplete()) {
+		// All chunks arrived but the data is not valid JSON
+		releaseResponse(response);
+		return false;
+	}
+	return true;
+}
+
+void JsonChunkReassembler::loop() {
+	unsigned long now = millis();
+	for(size_t ii = 0; ii < numResponses; ii++) {
+		if (responses[ii].inUse && now - responses[ii].lastChunkMillis >= timeoutMs) {
+			releaseResponse(&responses[ii]);
+		}
+	}
+}
+
+size_t JsonChunkReassembler::getNumInProgress() const {
+	size_t count = 0;
+	for(size_t ii = 0; ii < numResponses; ii++) {
+		if (responses[ii].inUse) {
+			count++;
+		}
+	}
+	return count;
+}
+
+JsonChunkReassembler::Response *JsonChunkReassembler::findResponse(const char *eventName, size_t eventNameLen) {
+	Response *freeResponse = NULL;
+
+	for(size_t ii = 0; ii < numResponses; ii++) {
+		Response *response = &responses[ii];
+		if (response->inUse) {
+			if (strncmp(response->eventName, eventName, eventNameLen) == 0 && response->eventName[eventNameLen] == 0) {
+				return response;
+			}
+		}
+		else
+		if (!freeResponse) {
+			freeResponse = response;
+		}
+	}
+
+	if (!freeResponse) {
+		return NULL;
+	}
+
+	if (!freeResponse->parser) {
+		freeResponse->parser = new JsonParser();
+		if (!freeResponse->parser) {
+			return NULL;
+		}
+		freeResponse->parser->setMaxBufferLen(maxBufferLen);
+	}
+
+	freeResponse->inUse = true;
+	memcpy(freeResponse->eventName, eventName, eventNameLen);
+	freeResponse->eventName[eventNameLen] = 0;
+	freeResponse->parser->clear();
+
+	return freeResponse;
+}
+
+void JsonChunkReassembler::releaseResponse(Response *response) {
+	response->inUse = false;
+	response->parser->clear();
+}
+
 
 //
 //
@@ -664,7 +1338,7 @@ JsonParserString::JsonParserString(String *str) : str(str), buf(0), bufLen(0), l
 
 JsonParserString::JsonParserString(char *buf, size_t bufLen) : str(0), buf(buf), bufLen(bufLen), length(0){
 	if (buf && bufLen) {
-		memset(buf, 0, bufLen);
+		buf[0] = 0;
 	}
 }
 
@@ -674,16 +1348,46 @@ void JsonParserString::append(char ch) {
 		length++;
 	}
 	else {
-		if (buf && length < (bufLen - 1)) {
+		if (buf && bufLen && length < (bufLen - 1)) {
 			buf[length] = ch;
+			buf[length + 1] = 0;
 		}
 		length++;
 	}
 }
 
 void JsonParserString::append(const char *str, size_t len) {
-	for(size_t ii = 0; ii < len; ii++) {
-		append(str[ii]);
+	if (this->str) {
+		// String can only append a c-string, so copy in null-terminated chunks. A null byte in the
+		// data would end the c-string early, so that chunk is appended one char at a time.
+		char tmp[33];
+		while(len > 0) {
+			size_t chunkLen = (len < sizeof(tmp) - 1) ? len : sizeof(tmp) - 1;
+			if (memchr(str, 0, chunkLen)) {
+				for(size_t ii = 0; ii < chunkLen; ii++) {
+					this->str->concat(str[ii]);
+				}
+			}
+			else {
+				memcpy(tmp, str, chunkLen);
+				tmp[chunkLen] = 0;
+				this->str->concat(tmp);
+			}
+			str += chunkLen;
+			len -= chunkLen;
+			length += chunkLen;
+		}
+	}
+	else {
+		if (buf && bufLen && length < (bufLen - 1)) {
+			size_t copyLen = bufLen - 1 - length;
+			if (copyLen > len) {
+				copyLen = len;
+			}
+			memcpy(&buf[length], str, copyLen);
+			buf[length + copyLen] = 0;
+		}
+		length += len;
 	}
 }
 
@@ -691,15 +1395,38 @@ void JsonParserString::append(const char *str, size_t len) {
 //
 //
 //
-JsonWriter::JsonWriter() : JsonBuffer(), floatPlaces(-1) {
+JsonWriter::JsonWriter() : JsonBuffer(), context(&rootContext), contextSize(1), staticContext(false), floatPlaces(-1) {
 	init();
 }
 
 JsonWriter::~JsonWriter() {
+	if (!staticContext && context != &rootContext) {
+		free(context);
+	}
+}
 
+JsonWriter::JsonWriter(char *buffer, size_t bufferLen) : JsonBuffer(buffer, bufferLen), context(&rootContext), contextSize(1), staticContext(false), floatPlaces(-1) {
+	init();
+}
+
+JsonWriter::JsonWriter(char *buffer, size_t bufferLen, JsonWriterContext *context, size_t contextSize) :
+	JsonBuffer(buffer, bufferLen), context(&rootContext), contextSize(1), staticContext(false), floatPlaces(-1) {
+	setContextBuffer(context, contextSize);
 }
 
-JsonWriter::JsonWriter(char *buffer, size_t bufferLen) : JsonBuffer(buffer, bufferLen), floatPlaces(-1) {
+void JsonWriter::setContextBuffer(JsonWriterContext *context, size_t contextSize) {
+	if (!staticContext && this->context != &rootContext) {
+		free(this->context);
+	}
+	if (!context || contextSize == 0) {
+		// Only the outer level
+		context = &rootContext;
+		contextSize = 1;
+	}
+	this->context = context;
+	this->contextSize = contextSize;
+	staticContext = true;
+
 	init();
 }
 
@@ -712,11 +1439,48 @@ void JsonWriter::init() {
 	context[contextIndex].terminator = 0;
 
 	truncated = false;
+	flushedLen = 0;
+
+}
+
+bool JsonWriter::growContext(size_t size) {
+	if (size <= contextSize) {
+		return true;
+	}
+	if (staticContext) {
+		return false;
+	}
 
+	size_t newSize = contextSize * 2;
+	if (newSize < MAX_NESTED_CONTEXT) {
+		newSize = MAX_NESTED_CONTEXT;
+	}
+	if (newSize < size) {
+		newSize = size;
+	}
+
+	JsonWriterContext *newContext;
+	if (context == &rootContext) {
+		newContext = (JsonWriterContext *) malloc(newSize * sizeof(JsonWriterContext));
+		if (newContext) {
+			newContext[0] = rootContext;
+		}
+	}
+	else {
+		newContext = (JsonWriterContext *) realloc(context, newSize * sizeof(JsonWriterContext));
+	}
+	if (!newContext) {
+		return false;
+	}
+	context = newContext;
+	contextSize = newSize;
+	return true;
 }
 
 bool JsonWriter::startObjectOrArray(char startChar, char endChar) {
-	if ((contextIndex + 1) >= MAX_NESTED_CONTEXT) {
+	if (!growContext(contextIndex + 2)) {
+		// Too deeply nested; the output would not be valid JSON
+		truncated = true;
 		return false;
 	}
 	insertCheckSeparator();
@@ -738,104 +1502,152 @@ void JsonWriter::finishObjectOrArray() {
 		}
 		contextIndex--;
 	}
-	// Make sure buffer is null terminated
-	if (offset < bufferLen) {
+	if (contextIndex == 0) {
+		// Finished the outer object or array, so send everything to the sink, if there is one
+		flush();
+	}
+	// Make sure buffer is null terminated, growing a dynamically allocated buffer if necessary
+	if (offset < bufferLen || (!staticBuffers && grow(offset + 1))) {
 		buffer[offset] = 0;
 	}
-	else {
+	else
+	if (buffer && bufferLen) {
 		buffer[bufferLen - 1] = 0;
 	}
 }
 
 
-void JsonWriter::insertChar(char ch) {
-	if (offset < bufferLen) {
-		buffer[offset++] = ch;
+void JsonWriter::insertJson(const char *json) {
+	insertChars(json, strlen(json));
+}
+
+
+// Returns the offset of the first byte at or after pos that can't be copied into a JSON string
+// as-is: a quote, backslash, control character, or byte with the high bit set (UTF-8).
+static size_t findStringEscape(const char *s, size_t pos, size_t len) {
+#if !defined(JSMN_NO_SIMD) && defined(__SSE2__)
+	// Signed compare against 0x20 also finds bytes 0x80 and above, which are negative
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	for(; pos + 16 <= len; pos += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)&s[pos]);
+		__m128i special = _mm_or_si128(_mm_cmplt_epi8(chunk, space),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(special);
+		if (mask) {
+			return pos + __builtin_ctz(mask);
+		}
 	}
-	else {
-		truncated = true;
+#elif !defined(JSMN_NO_SIMD) && defined(__ARM_NEON)
+	const int8x16_t space = vdupq_n_s8(0x20);
+	const int8x16_t quote = vdupq_n_s8('"');
+	const int8x16_t backslash = vdupq_n_s8('\\');
+	for(; pos + 16 <= len; pos += 16) {
+		int8x16_t chunk = vld1q_s8((const int8_t *)&s[pos]);
+		uint8x16_t special = vorrq_u8(vcltq_s8(chunk, space), vorrq_u8(vceqq_s8(chunk, quote), vceqq_s8(chunk, backslash)));
+		uint64x2_t special64 = vreinterpretq_u64_u8(special);
+		if (vgetq_lane_u64(special64, 0) | vgetq_lane_u64(special64, 1)) {
+			break;
+		}
 	}
-}
-
-void JsonWriter::insertJson(const char *json) {
-	for(size_t ii = 0; json[ii]; ii++) {
-		insertChar(json[ii]);
+#endif
+	for(; pos < len; pos++) {
+		if (JsonWriter::stringEscapeClass[(uint8_t)s[pos]]) {
+			break;
+		}
 	}
-}
-
+	return pos;
+}
+
+const uint8_t JsonWriter::stringEscapeClass[256] = {
+		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+		0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
 
 void JsonWriter::insertString(const char *s, bool quoted) {
-	// 0x00000000 - 0x0000007F:
-
-	// 0x00000080 - 0x000007FF:
-	// 110xxxxx 10xxxxxx
-
-	// 0x00000800 - 0x0000FFFF:
-	// 1110xxxx 10xxxxxx 10xxxxxx
+	static const char hexDigits[] = "0123456789ABCDEF";
 
 	if (quoted) {
 		insertChar('"');
 	}
 
-	for(size_t ii = 0; s[ii] && offset < bufferLen; ii++) {
-		if (s[ii] & 0x80) {
+	size_t len = strlen(s);
+	if (!staticBuffers) {
+		// Make room for the whole string at once instead of growing in steps. More may be needed for escapes.
+		ensureSpace(len + 1);
+	}
+	for(size_t ii = 0; ii < len && !truncated; ) {
+		// Copy the run of characters that don't need escaping at once
+		size_t runEnd = findStringEscape(s, ii, len);
+		if (runEnd > ii) {
+			insertChars(&s[ii], runEnd - ii);
+			ii = runEnd;
+			if (ii >= len) {
+				break;
+			}
+		}
+
+		char escape[6];
+		size_t escapeLen = 2;
+		uint8_t cls = stringEscapeClass[(uint8_t)s[ii]];
+		if (cls == 1) {
 			// High bit set: convert UTF-8 to JSON Unicode escape
+			uint16_t utf16;
 			if (((s[ii] & 0b11110000) == 0b11100000) && ((s[ii+1] & 0b11000000) == 0b10000000) && ((s[ii+2] & 0b11000000) == 0b10000000)) {
 				// 3-byte
-				uint16_t utf16 = ((s[ii] & 0b1111) << 12) | ((s[ii+1] & 0b111111) << 6) | (s[ii+2] & 0b111111);
-				insertsprintf("\\u%04X", utf16);
-				ii += 2; // plus one more in loop increment
+				utf16 = ((s[ii] & 0b1111) << 12) | ((s[ii+1] & 0b111111) << 6) | (s[ii+2] & 0b111111);
+				ii += 3;
 			}
 			else
 			if (((s[ii] & 0b11100000) == 0b11000000) && ((s[ii+1] & 0b11000000) == 0b10000000)) {
 				// 2-byte
-				uint16_t utf16 = ((s[ii] & 0b11111) << 6) | (s[ii+1] & 0b111111);
-				insertsprintf("\\u%04X", utf16);
-				ii++; // plus one more in loop increment
+				utf16 = ((s[ii] & 0b11111) << 6) | (s[ii+1] & 0b111111);
+				ii += 2;
 			}
 			else {
 				// Not valid unicode, just pass characters through
-				insertChar(s[ii]);
+				insertChar(s[ii++]);
+				continue;
 			}
+			escape[2] = hexDigits[(utf16 >> 12) & 0xf];
+			escape[3] = hexDigits[(utf16 >> 8) & 0xf];
+			escape[4] = hexDigits[(utf16 >> 4) & 0xf];
+			escape[5] = hexDigits[utf16 & 0xf];
+			escape[1] = 'u';
+			escapeLen = 6;
+		}
+		else
+		if (cls == 'u') {
+			// Other control characters are not allowed in JSON strings
+			escape[1] = 'u';
+			escape[2] = '0';
+			escape[3] = '0';
+			escape[4] = hexDigits[(s[ii] >> 4) & 0xf];
+			escape[5] = hexDigits[s[ii] & 0xf];
+			escapeLen = 6;
+			ii++;
 		}
 		else {
-			switch(s[ii]) {
-			case '\b':
-				insertChar('\\');
-				insertChar('b');
-				break;
-
-			case '\f':
-				insertChar('\\');
-				insertChar('f');
-				break;
-
-			case '\n':
-				insertChar('\\');
-				insertChar('n');
-				break;
-
-			case '\r':
-				insertChar('\\');
-				insertChar('r');
-				break;
-
-			case '\t':
-				insertChar('\\');
-				insertChar('t');
-				break;
-
-			case '"':
-			case '\\':
-				insertChar('\\');
-				insertChar(s[ii]);
-				break;
-
-			default:
-				insertChar(s[ii]);
-				break;
-			}
+			escape[1] = (char)cls;
+			ii++;
 		}
+		escape[0] = '\\';
+		insertChars(escape, escapeLen);
 	}
 	if (quoted) {
 		insertChar('"');
@@ -852,52 +1664,535 @@ void JsonWriter::insertsprintf(const char *fmt, ...) {
 	va_end(ap);
 }
 
-void JsonWriter::insertvsprintf(const char *fmt, va_list ap) {
-	size_t spaceAvailable = bufferLen - offset;
-
-	size_t count = vsnprintf(&buffer[offset], spaceAvailable, fmt, ap);
-	if (count <= spaceAvailable) {
-		offset += count;
+void JsonWriter::insertvsprintf(const char *fmt, va_list ap) {
+	size_t spaceAvailable = bufferLen - offset;
+
+	va_list apCopy;
+	va_copy(apCopy, ap);
+	// vsnprintf needs room for a null terminator after the count characters
+	size_t count = vsnprintf(&buffer[offset], spaceAvailable, fmt, ap);
+	if (count >= spaceAvailable) {
+		// Make room by growing the buffer or flushing to the sink and try again. Output that is larger
+		// than the staging buffer of a sink is truncated, so it still uses a constant amount of RAM.
+		ensureSpace(count + 1);
+		if (buffer && (bufferLen - offset) != spaceAvailable) {
+			spaceAvailable = bufferLen - offset;
+			count = vsnprintf(&buffer[offset], spaceAvailable, fmt, apCopy);
+		}
+	}
+	va_end(apCopy);
+
+	if (count < spaceAvailable) {
+		offset += count;
+	}
+	else {
+		// Truncated, no more space left
+		offset = bufferLen;
+		truncated = true;
+	}
+}
+
+JsonWriterCheckpoint JsonWriter::checkpoint() const {
+	JsonWriterCheckpoint result;
+	result.offset = offset;
+	result.contextIndex = contextIndex;
+	result.isFirstBits = 0;
+	for(size_t ii = 0; ii < sizeof(result.terminators) && ii <= contextIndex; ii++) {
+		if (context[ii].isFirst) {
+			result.isFirstBits |= (1UL << ii);
+		}
+		result.terminators[ii] = context[ii].terminator;
+	}
+	result.flushedLen = flushedLen;
+	result.truncated = truncated;
+	return result;
+}
+
+bool JsonWriter::rollback(const JsonWriterCheckpoint &checkpoint) {
+	if (flushedLen != checkpoint.flushedLen) {
+		// The data has already been sent
+		return false;
+	}
+	if (checkpoint.contextIndex >= sizeof(checkpoint.terminators)) {
+		// Too deep to have saved the state of every level
+		return false;
+	}
+	offset = checkpoint.offset;
+	contextIndex = checkpoint.contextIndex;
+	// Restore every level, as objects and arrays may have been finished and others started in their place
+	for(size_t ii = 0; ii <= contextIndex; ii++) {
+		context[ii].isFirst = (checkpoint.isFirstBits & (1UL << ii)) != 0;
+		context[ii].terminator = checkpoint.terminators[ii];
+	}
+	truncated = checkpoint.truncated;
+	return true;
+}
+
+void JsonWriter::insertCheckSeparator() {
+	if (context[contextIndex].isFirst) {
+		context[contextIndex].isFirst = false;
+	}
+	else {
+		insertChar(',');
+	}
+}
+
+void JsonWriter::insertValue(bool value) {
+	if (value) {
+		insertString("true");
+	}
+	else {
+		insertString("false");
+	}
+}
+
+// Shortest round-trip floating point formatting using the Grisu2 algorithm (Florian Loitsch,
+// "Printing Floating-Point Numbers Quickly and Accurately with Integers", 2010), as adapted in
+// RapidJSON. It produces the shortest (or in rare cases, nearly shortest) decimal that converts back
+// to exactly the same float or double, using only 64-bit integer math.
+
+// A floating point value f * 2^e with a 64-bit significand
+struct DiyFp {
+	uint64_t f;
+	int e;
+};
+
+static DiyFp diyFpSubtract(const DiyFp &a, const DiyFp &b) {
+	DiyFp result = { a.f - b.f, a.e };
+	return result;
+}
+
+// Multiplies two DiyFp, keeping the upper 64 bits of the product, rounded
+static DiyFp diyFpMultiply(const DiyFp &x, const DiyFp &y) {
+	const uint64_t M32 = 0xFFFFFFFF;
+	uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32) + (1U << 31);
+	DiyFp result = { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
+	return result;
+}
+
+static DiyFp diyFpNormalize(const DiyFp &x) {
+	int shift = __builtin_clzll(x.f);
+	DiyFp result = { x.f << shift, x.e - shift };
+	return result;
+}
+
+// Normalized powers of 10 from 10^-348 to 10^340 in steps of 8
+static const uint64_t cachedPowersF[] = {
+	0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+	0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+	0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+	0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+	0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+	0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+	0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+	0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+	0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+	0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+	0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+	0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+	0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+	0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+	0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+	0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+	0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+	0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+	0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+	0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+	0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+	0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+static const int16_t cachedPowersE[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+	-901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+	-582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+	-263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+	56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+	694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+	1013, 1039, 1066,
+};
+
+// Gets a cached power of 10 c such that e + c.e + 64 is in the range [-60, -32], and the
+// decimal exponent of it in K
+static DiyFp getCachedPower(int e, int &K) {
+	double dk = (-61 - e) * 0.30102999566398114 + 347; // dk must be positive, so can do ceiling in positive
+	int k = (int)dk;
+	if (dk - k > 0.0) {
+		k++;
+	}
+	unsigned index = (unsigned)((k >> 3) + 1);
+	K = -(-348 + (int)(index << 3));
+	DiyFp result = { cachedPowersF[index], cachedPowersE[index] };
+	return result;
+}
+
+static const uint64_t powersOf10U64[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+	1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+	1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static void grisuRound(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpw) {
+	while (rest < wpw && delta - rest >= tenKappa &&
+			(rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+		buf[len - 1]--;
+		rest += tenKappa;
+	}
+}
+
+// Generates the shortest digits of W within the range (Mp - delta, Mp)
+static int grisuDigitGen(const DiyFp &W, const DiyFp &Mp, uint64_t delta, char *buf, int &K) {
+	const DiyFp one = { 1ULL << -Mp.e, Mp.e };
+	const DiyFp wpw = diyFpSubtract(Mp, W);
+	uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+	uint64_t p2 = Mp.f & (one.f - 1);
+	int len = 0;
+
+	int kappa = 1;
+	while(kappa < 10 && p1 >= powersOf10U64[kappa]) {
+		kappa++;
+	}
+
+	while(kappa > 0) {
+		uint32_t div = (uint32_t)powersOf10U64[kappa - 1];
+		uint32_t d = p1 / div;
+		p1 %= div;
+		if (d || len) {
+			buf[len++] = (char)('0' + d);
+		}
+		kappa--;
+		uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+		if (tmp <= delta) {
+			K += kappa;
+			grisuRound(buf, len, delta, tmp, powersOf10U64[kappa] << -one.e, wpw.f);
+			return len;
+		}
+	}
+
+	while(true) {
+		p2 *= 10;
+		delta *= 10;
+		char d = (char)(p2 >> -one.e);
+		if (d || len) {
+			buf[len++] = (char)('0' + d);
+		}
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			K += kappa;
+			int index = -kappa;
+			grisuRound(buf, len, delta, p2, one.f, wpw.f * (index < 20 ? powersOf10U64[index] : 0));
+			return len;
+		}
+	}
+}
+
+// Generates the shortest digits for the positive value f * 2^e, where hiddenBit is the implicit
+// leading bit of a normalized significand, 2^23 for float or 2^52 for double. The value is
+// digits * 10^K.
+static int grisu2(uint64_t f, int e, uint64_t hiddenBit, char *buf, int &K) {
+	// Boundaries halfway to the next float or double above and below
+	DiyFp v = { f, e };
+	DiyFp plus = { (f << 1) + 1, e - 1 };
+	plus = diyFpNormalize(plus);
+	DiyFp minus;
+	if (f == hiddenBit) {
+		// Next value below is closer because the exponent is smaller
+		minus.f = (f << 2) - 1;
+		minus.e = e - 2;
+	}
+	else {
+		minus.f = (f << 1) - 1;
+		minus.e = e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	const DiyFp cmk = getCachedPower(plus.e, K);
+	const DiyFp W = diyFpMultiply(diyFpNormalize(v), cmk);
+	DiyFp Wp = diyFpMultiply(plus, cmk);
+	DiyFp Wm = diyFpMultiply(minus, cmk);
+	Wm.f++;
+	Wp.f--;
+	return grisuDigitGen(W, Wp, Wp.f - Wm.f, buf, K);
+}
+
+// Formats digits * 10^K the way JavaScript does: plain decimal for values from 1e-6 up to 1e21,
+// otherwise an exponent. Returns the length. buf must have room for 26 characters.
+static size_t formatDigits(char *buf, int len, int K) {
+	int kk = len + K; // 10^(kk-1) <= v < 10^kk
+
+	if (K >= 0 && kk <= 21) {
+		// 1234e7 -> 12340000000
+		memset(&buf[len], '0', K);
+		return kk;
+	}
+	if (kk > 0 && kk <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(&buf[kk + 1], &buf[kk], len - kk);
+		buf[kk] = '.';
+		return len + 1;
+	}
+	if (kk > -6 && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		int offset = 2 - kk;
+		memmove(&buf[offset], buf, len);
+		buf[0] = '0';
+		buf[1] = '.';
+		memset(&buf[2], '0', offset - 2);
+		return len + offset;
+	}
+
+	// 1234e30 -> 1.234e33
+	size_t result = 1;
+	if (len > 1) {
+		memmove(&buf[2], &buf[1], len - 1);
+		buf[1] = '.';
+		result = len + 1;
+	}
+	buf[result++] = 'e';
+	int exp = kk - 1;
+	if (exp < 0) {
+		buf[result++] = '-';
+		exp = -exp;
+	}
+	if (exp >= 100) {
+		buf[result++] = (char)('0' + exp / 100);
+		exp %= 100;
+		buf[result++] = (char)('0' + exp / 10);
+	}
+	else
+	if (exp >= 10) {
+		buf[result++] = (char)('0' + exp / 10);
+	}
+	buf[result++] = (char)('0' + exp % 10);
+	return result;
+}
+
+// Formats value with a fixed number of decimal places. This is faster than vsnprintf, but it scales
+// the value by 10^places, which rounds. When the scaled value is within that rounding error of a tie,
+// or too large to scale accurately, it returns 0 and the caller uses vsnprintf instead.
+static size_t formatFixed(double value, int places, char *buf) {
+	if (places > 9) {
+		return 0;
+	}
+	double absValue = (value < 0) ? -value : value;
+	double scaled = absValue * (double)powersOf10U64[places];
+	if (!(scaled < 4294967296.0)) { // 2^32, also false for NaN
+		return 0;
+	}
+	// Both the integer and fractional parts are exact. The multiply is off by at most half an ulp of
+	// scaled, 2^-53 * scaled; twice that is used as the margin around the tie.
+	uint64_t rounded = (uint64_t)scaled;
+	double frac = scaled - (double)rounded;
+	double margin = scaled * (1.0 / 4503599627370496.0); // 2^-52
+	if (frac - 0.5 <= margin && 0.5 - frac <= margin) {
+		return 0;
+	}
+	if (frac > 0.5) {
+		rounded++;
+	}
+
+	char digits[24];
+	int numDigits = 0;
+	do {
+		digits[numDigits++] = (char)('0' + rounded % 10);
+		rounded /= 10;
+	} while(rounded || numDigits <= places);
+
+	size_t len = 0;
+	if (value < 0) {
+		buf[len++] = '-';
+	}
+	while(numDigits > 0) {
+		if (numDigits == places) {
+			buf[len++] = '.';
+		}
+		buf[len++] = digits[--numDigits];
+	}
+	return len;
+}
+
+// Formats a float or double (significand f, exponent e) with the shortest representation that
+// converts back to the same value. NaN and infinity are not valid JSON, so they are written as null.
+static size_t formatShortest(bool negative, uint64_t f, int e, uint64_t hiddenBit, bool isFinite, char *buf) {
+	if (!isFinite) {
+		memcpy(buf, "null", 4);
+		return 4;
+	}
+
+	size_t len = 0;
+	if (negative) {
+		buf[len++] = '-';
+	}
+	if (f == 0) {
+		buf[len++] = '0';
+		return len;
+	}
+	int K;
+	int numDigits = grisu2(f, e, hiddenBit, &buf[len], K);
+	return len + formatDigits(&buf[len], numDigits, K);
+}
+
+void JsonWriter::insertValue(float value) {
+	char buf[32];
+	size_t len = 0;
+
+	if (floatPlaces >= 0) {
+		len = formatFixed(value, floatPlaces, buf);
+		if (len == 0) {
+			insertsprintf("%.*f", floatPlaces, value);
+			return;
+		}
+	}
+	else {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		int biasedExp = (bits >> 23) & 0xff;
+		uint64_t f = bits & 0x7fffff;
+		int e;
+		if (biasedExp != 0) {
+			f += (1UL << 23);
+			e = biasedExp - 150;
+		}
+		else {
+			e = -149;
+		}
+		len = formatShortest((bits >> 31) != 0, f, e, 1UL << 23, biasedExp != 0xff, buf);
+	}
+	insertChars(buf, len);
+}
+
+void JsonWriter::insertValue(double value) {
+	char buf[32];
+	size_t len = 0;
+
+	if (floatPlaces >= 0) {
+		len = formatFixed(value, floatPlaces, buf);
+		if (len == 0) {
+			insertsprintf("%.*lf", floatPlaces, value);
+			return;
+		}
+	}
+	else {
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+
+		int biasedExp = (int)((bits >> 52) & 0x7ff);
+		uint64_t f = bits & 0xfffffffffffffULL;
+		int e;
+		if (biasedExp != 0) {
+			f += (1ULL << 52);
+			e = biasedExp - 1075;
+		}
+		else {
+			e = -1074;
+		}
+		len = formatShortest((bits >> 63) != 0, f, e, 1ULL << 52, biasedExp != 0x7ff, buf);
+	}
+	insertChars(buf, len);
+}
+
+void JsonWriter::insertChars(const char *s, size_t len) {
+	while(!ensureSpace(len)) {
+		// Insert what fits, then flush it to the sink, if there is one, and continue with the rest
+		size_t partLen = (offset < bufferLen) ? (bufferLen - offset) : 0;
+		if (partLen) {
+			memcpy(&buffer[offset], s, partLen);
+			offset += partLen;
+			s += partLen;
+			len -= partLen;
+		}
+		if (offset == 0 || !flush()) {
+			truncated = true;
+			return;
+		}
 	}
-	else {
-		// Truncated, no more space left
-		offset = bufferLen;
-		truncated = true;
+	if (len) {
+		memcpy(&buffer[offset], s, len);
+		offset += len;
 	}
 }
 
-void JsonWriter::insertCheckSeparator() {
-	if (context[contextIndex].isFirst) {
-		context[contextIndex].isFirst = false;
+bool JsonWriter::ensureSpace(size_t len) {
+	if (buffer && (offset + len) <= bufferLen) {
+		return true;
 	}
-	else {
-		insertChar(',');
+	if (!staticBuffers) {
+		// Dynamically allocated buffer, grow it geometrically
+		return grow(offset + len);
 	}
+	// Make room by flushing to the sink, if there is one
+	return buffer && flush() && (offset + len) <= bufferLen;
 }
 
-void JsonWriter::insertValue(bool value) {
-	if (value) {
-		insertString("true");
+bool JsonWriter::flush() {
+	return false;
+}
+
+void JsonWriter::insertSignedValue(long long value) {
+	if (value < 0) {
+		// Negate as unsigned so the most negative value works
+		insertUnsignedValue(0ULL - (unsigned long long)value, true);
 	}
 	else {
-		insertString("false");
+		insertUnsignedValue((unsigned long long)value);
 	}
 }
 
-void JsonWriter::insertValue(float value) {
-	if (floatPlaces >= 0) {
-		insertsprintf("%.*f", floatPlaces, value);
+void JsonWriter::insertUnsignedValue(unsigned long long value, bool negative) {
+	static const char digitPairs[] =
+		"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+		"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+	size_t numDigits = 1;
+	while(numDigits < 20 && value >= powersOf10U64[numDigits]) {
+		numDigits++;
+	}
+
+	size_t len = numDigits + (negative ? 1 : 0);
+	char tmp[21];
+	bool fits = ensureSpace(len);
+
+	// Write backwards from the end, into the buffer if it fits
+	char *start = fits ? &buffer[offset] : tmp;
+	char *cp = start + len;
+
+	// Do the upper digits using 64-bit math, but switch to 32-bit as soon as possible since
+	// 64-bit division is slow on 32-bit processors
+	while(value > 0xffffffffULL) {
+		unsigned pair = (unsigned)(value % 100) * 2;
+		value /= 100;
+		*--cp = digitPairs[pair + 1];
+		*--cp = digitPairs[pair];
+	}
+	uint32_t value32 = (uint32_t)value;
+	while(value32 >= 100) {
+		unsigned pair = (value32 % 100) * 2;
+		value32 /= 100;
+		*--cp = digitPairs[pair + 1];
+		*--cp = digitPairs[pair];
+	}
+	if (value32 >= 10) {
+		*--cp = digitPairs[value32 * 2 + 1];
+		*--cp = digitPairs[value32 * 2];
 	}
 	else {
-		insertsprintf("%f", value);
+		*--cp = (char)('0' + value32);
 	}
-}
-void JsonWriter::insertValue(double value) {
-	if (floatPlaces >= 0) {
-		insertsprintf("%.*lf", floatPlaces, value);
+	if (negative) {
+		*--cp = '-';
+	}
+
+	if (fits) {
+		offset += len;
 	}
 	else {
-		insertsprintf("%lf", value);
+		insertChars(tmp, len);
 	}
 }
 
@@ -932,6 +2227,103 @@ void JsonWriter::setIsFirst(bool isFirst /* = true */) {
 }
 
 
+JsonSinkWriter::JsonSinkWriter(char *buffer, size_t bufferLen, SinkFunction sink) : JsonWriter(buffer, bufferLen), sink(sink) {
+
+}
+
+JsonSinkWriter::JsonSinkWriter(char *buffer, size_t bufferLen, Print &print) : JsonWriter(buffer, bufferLen) {
+	sink = [&print](const char *data, size_t dataLen) {
+		return print.write((const uint8_t *)data, dataLen) == dataLen;
+	};
+}
+
+JsonSinkWriter::~JsonSinkWriter() {
+
+}
+
+bool JsonSinkWriter::flush() {
+	if (offset == 0) {
+		return true;
+	}
+	if (!sink || !sink(buffer, offset)) {
+		// Keep the data; the buffer stays full so the writer sets the truncated flag
+		return false;
+	}
+	flushedLen += offset;
+	offset = 0;
+	return true;
+}
+
+
+JsonChunkedWriter::JsonChunkedWriter(char *buffer, size_t bufferLen, const char *eventNamePrefix, size_t chunkSize, ChunkFunction chunkFunction) :
+		JsonWriter(buffer, bufferLen), chunkSize(chunkSize), chunkIndex(0), chunkFunction(chunkFunction) {
+	eventNamePrefixLen = strlen(eventNamePrefix);
+	if (eventNamePrefixLen > MAX_EVENT_NAME_PREFIX) {
+		eventNamePrefixLen = MAX_EVENT_NAME_PREFIX;
+	}
+	memcpy(eventName, eventNamePrefix, eventNamePrefixLen);
+	eventName[eventNamePrefixLen] = 0;
+}
+
+JsonChunkedWriter::~JsonChunkedWriter() {
+
+}
+
+void JsonChunkedWriter::init() {
+	JsonWriter::init();
+	chunkIndex = 0;
+}
+
+bool JsonChunkedWriter::flush() {
+	if (chunkSize == 0 || bufferLen <= chunkSize) {
+		// No room to null terminate a chunk
+		return false;
+	}
+
+	// Send all of the full chunks. The byte after each one is needed to null terminate it.
+	bool result = true;
+	size_t sent = 0;
+	while(result && offset - sent >= chunkSize && sent + chunkSize < bufferLen) {
+		result = sendChunk(sent, chunkSize);
+		if (result) {
+			sent += chunkSize;
+		}
+	}
+	if (sent) {
+		memmove(buffer, &buffer[sent], offset - sent);
+		offset -= sent;
+	}
+
+	if (result && contextIndex == 0 && offset > 0) {
+		// The outer object or array is finished, so this is the last chunk
+		result = sendChunk(0, offset);
+		if (result) {
+			offset = 0;
+		}
+	}
+
+	// Even if nothing was sent there is room for more data, as less than a chunk is buffered
+	return result;
+}
+
+bool JsonChunkedWriter::sendChunk(size_t start, size_t len) {
+	snprintf(&eventName[eventNamePrefixLen], sizeof(eventName) - eventNamePrefixLen, "/%u", (unsigned int)chunkIndex);
+
+	// Temporarily null terminate the chunk
+	char saved = buffer[start + len];
+	buffer[start + len] = 0;
+	bool result = chunkFunction && chunkFunction(eventName, &buffer[start], len);
+	buffer[start + len] = saved;
+
+	eventName[eventNamePrefixLen] = 0;
+	if (result) {
+		chunkIndex++;
+		flushedLen += len;
+	}
+	return result;
+}
+
+
 
 JsonModifier::JsonModifier(JsonParser &jp) : jp(jp) {
 
@@ -1145,6 +2537,239 @@ int JsonModifier::findRightComma(const JsonParserGeneratorRK::jsmntok_t *tok) co
 	return ii;
 }
 
+//
+
+JsonSaxParser::JsonSaxParser() : JsonBuffer() {
+}
+
+JsonSaxParser::~JsonSaxParser() {
+}
+
+JsonSaxParser::JsonSaxParser(char *buffer, size_t bufferLen) : JsonBuffer(buffer, bufferLen) {
+}
+
+// static
+bool JsonSaxParser::isNumber(const char *str, size_t len) {
+	const char *end = str + len;
+
+	if (str < end && *str == '-') {
+		str++;
+	}
+
+	// Integer part: 0, or digits not starting with 0
+	if (str == end || *str < '0' || *str > '9') {
+		return false;
+	}
+	if (*str++ != '0') {
+		while(str < end && *str >= '0' && *str <= '9') {
+			str++;
+		}
+	}
+
+	// Fraction, at least one digit
+	if (str < end && *str == '.') {
+		str++;
+		if (str == end || *str < '0' || *str > '9') {
+			return false;
+		}
+		while(str < end && *str >= '0' && *str <= '9') {
+			str++;
+		}
+	}
+
+	// Exponent, optional sign and at least one digit
+	if (str < end && (*str == 'e' || *str == 'E')) {
+		str++;
+		if (str < end && (*str == '+' || *str == '-')) {
+			str++;
+		}
+		if (str == end || *str < '0' || *str > '9') {
+			return false;
+		}
+		while(str < end && *str >= '0' && *str <= '9') {
+			str++;
+		}
+	}
+
+	return str == end;
+}
+
+bool JsonSaxParser::parse(JsonSaxHandler &handler) {
+	// What can come next
+	enum {
+		EXPECT_VALUE,	// Value (also a close if canClose)
+		EXPECT_KEY,		// Key string (also a close if canClose)
+		EXPECT_COLON,	// Colon after a key
+		EXPECT_COMMA,	// Comma or close after a value
+		EXPECT_END		// Only whitespace after the outer value
+	} expect = EXPECT_VALUE;
+	bool canClose = false; // True right after { or [ for empty objects and arrays
+	size_t depth = 0;
+	uint32_t objectBits = 0; // Bit n is set if the container at depth n + 1 is an object
+
+	if (!buffer) {
+		return false;
+	}
+
+	for(size_t pos = 0; pos < offset && buffer[pos] != 0; pos++) {
+		char c = buffer[pos];
+		switch(c) {
+		case '\t': case '\r': case '\n': case ' ':
+			continue;
+
+		case '{': case '[':
+			if (expect != EXPECT_VALUE || depth >= MAX_DEPTH) {
+				return false;
+			}
+			if (c == '{') {
+				objectBits |= (1UL << depth);
+				expect = EXPECT_KEY;
+				if (!handler.startObject()) {
+					return false;
+				}
+			}
+			else {
+				objectBits &= ~(1UL << depth);
+				if (!handler.startArray()) {
+					return false;
+				}
+			}
+			depth++;
+			canClose = true;
+			continue;
+
+		case '}': case ']': {
+			bool isObject = (c == '}');
+			if (depth == 0 || isObject != (((objectBits >> (depth - 1)) & 1) != 0)) {
+				return false;
+			}
+			if (expect != EXPECT_COMMA && !canClose) {
+				return false;
+			}
+			depth--;
+			if (!(isObject ? handler.endObject() : handler.endArray())) {
+				return false;
+			}
+			break;
+		}
+
+		case ',':
+			if (expect != EXPECT_COMMA) {
+				return false;
+			}
+			expect = ((objectBits >> (depth - 1)) & 1) ? EXPECT_KEY : EXPECT_VALUE;
+			canClose = false;
+			continue;
+
+		case ':':
+			if (expect != EXPECT_COLON) {
+				return false;
+			}
+			expect = EXPECT_VALUE;
+			continue;
+
+		case '"': {
+			if (expect != EXPECT_VALUE && expect != EXPECT_KEY) {
+				return false;
+			}
+			size_t start = ++pos;
+			while(true) {
+				pos = JsonParserGeneratorRK::jsmn_scan_string(buffer, pos, offset);
+				if (pos >= offset || buffer[pos] == 0) {
+					// Unterminated string
+					return false;
+				}
+				if (buffer[pos] == '"') {
+					break;
+				}
+
+				// Backslash
+				pos++;
+				if (pos >= offset) {
+					return false;
+				}
+				switch(buffer[pos]) {
+				case '"': case '/': case '\\': case 'b': case 'f': case 'r': case 'n': case 't':
+					pos++;
+					break;
+
+				case 'u':
+					for(size_t ii = 1; ii <= 4; ii++) {
+						if (pos + ii >= offset || !isxdigit((unsigned char)buffer[pos + ii])) {
+							return false;
+						}
+					}
+					pos += 5;
+					break;
+
+				default:
+					return false;
+				}
+			}
+
+			if (expect == EXPECT_KEY) {
+				if (!handler.key(&buffer[start], pos - start)) {
+					return false;
+				}
+				expect = EXPECT_COLON;
+				canClose = false;
+				continue;
+			}
+			if (!handler.string(&buffer[start], pos - start)) {
+				return false;
+			}
+			break;
+		}
+
+		default: {
+			// Primitive: number, true, false, or null
+			if (expect != EXPECT_VALUE) {
+				return false;
+			}
+			size_t start = pos;
+			for(; pos < offset; pos++) {
+				c = buffer[pos];
+				if (c == 0 || c == ',' || c == ']' || c == '}' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+					break;
+				}
+			}
+			size_t len = pos - start;
+			const char *str = &buffer[start];
+			pos--;
+
+			bool result;
+			if (len == 4 && memcmp(str, "true", 4) == 0) {
+				result = handler.boolean(true);
+			}
+			else
+			if (len == 5 && memcmp(str, "false", 5) == 0) {
+				result = handler.boolean(false);
+			}
+			else
+			if (len == 4 && memcmp(str, "null", 4) == 0) {
+				result = handler.null();
+			}
+			else
+			if (isNumber(str, len)) {
+				result = handler.number(str, len);
+			}
+			else {
+				return false;
+			}
+			if (!result) {
+				return false;
+			}
+			break;
+		}
+		}
+
+		// A value was completed
+		expect = (depth == 0) ? EXPECT_END : EXPECT_COMMA;
+		canClose = false;
+	}
+
+	return expect == EXPECT_END;
+}
 
 
 // begin jsmn.cpp
@@ -1161,14 +2786,29 @@ static jsmntok_t *jsmn_alloc_token(jsmn_parser *parser,
 		return NULL;
 	}
 	tok = &tokens[parser->toknext++];
-	tok->start = tok->end = -1;
+	tok->start = tok->end = JSMN_POS_INVALID;
 	tok->size = 0;
+	tok->extent = 1;
+	tok->escaped = 0;
 #ifdef JSMN_PARENT_LINKS
 	tok->parent = -1;
 #endif
 	return tok;
 }
 
+/**
+ * Increments the size of a parent token. Returns false if the size does not fit in the token.
+ */
+static bool jsmn_add_child(jsmntok_t *parent) {
+#ifdef JSMN_COMPACT_TOKENS
+	if (parent->size >= JSMN_SIZE_MAX) {
+		return false;
+	}
+#endif
+	parent->size++;
+	return true;
+}
+
 /**
  * Fills token type and boundaries.
  */
@@ -1229,6 +2869,76 @@ found:
 	return 0;
 }
 
+/**
+ * Returns the offset of the first quote, backslash, or null byte at or after pos, or len
+ * if there isn't one. This is where jsmn_parse_string spends most of its time, so it checks
+ * 16 or 32 bytes at a time with SIMD instructions, or 4 bytes at a time in a 32-bit word.
+ */
+unsigned int jsmn_scan_string(const char *js, unsigned int pos, size_t len) {
+#if !defined(JSMN_NO_SIMD) && defined(__AVX2__)
+	const __m256i quote32 = _mm256_set1_epi8('"');
+	const __m256i backslash32 = _mm256_set1_epi8('\\');
+	const __m256i zero32 = _mm256_setzero_si256();
+	for(; pos + 32 <= len; pos += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)&js[pos]);
+		__m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote32),
+				_mm256_cmpeq_epi8(chunk, backslash32)), _mm256_cmpeq_epi8(chunk, zero32));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(special);
+		if (mask) {
+			return pos + __builtin_ctz(mask);
+		}
+	}
+#endif
+#if !defined(JSMN_NO_SIMD) && defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i zero = _mm_setzero_si128();
+	for(; pos + 16 <= len; pos += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)&js[pos]);
+		__m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+				_mm_cmpeq_epi8(chunk, backslash)), _mm_cmpeq_epi8(chunk, zero));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(special);
+		if (mask) {
+			return pos + __builtin_ctz(mask);
+		}
+	}
+#elif !defined(JSMN_NO_SIMD) && defined(__ARM_NEON)
+	const uint8x16_t quote = vdupq_n_u8('"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t zero = vdupq_n_u8(0);
+	for(; pos + 16 <= len; pos += 16) {
+		uint8x16_t chunk = vld1q_u8((const uint8_t *)&js[pos]);
+		uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(chunk, quote), vceqq_u8(chunk, backslash)), vceqq_u8(chunk, zero));
+		uint64x2_t special64 = vreinterpretq_u64_u8(special);
+		if (vgetq_lane_u64(special64, 0) | vgetq_lane_u64(special64, 1)) {
+			// Found one in this block; the scalar loop below finds which byte
+			break;
+		}
+	}
+#endif
+	// Portable version: check 4 bytes at a time using the "has a zero byte" trick on
+	// the word XORed with each of the special characters
+	for(; pos + 4 <= len; pos += 4) {
+		uint32_t word;
+		memcpy(&word, &js[pos], sizeof(word));
+		uint32_t quoteWord = word ^ 0x22222222;
+		uint32_t backslashWord = word ^ 0x5c5c5c5c;
+		uint32_t special = ((word - 0x01010101) & ~word) |
+				((quoteWord - 0x01010101) & ~quoteWord) |
+				((backslashWord - 0x01010101) & ~backslashWord);
+		if (special & 0x80808080) {
+			break;
+		}
+	}
+	for(; pos < len; pos++) {
+		char c = js[pos];
+		if (c == '"' || c == '\\' || c == '\0') {
+			break;
+		}
+	}
+	return pos;
+}
+
 /**
  * Fills next token with JSON string.
  */
@@ -1237,11 +2947,17 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
 	jsmntok_t *token;
 
 	int start = parser->pos;
+	bool escaped = false;
 
 	parser->pos++;
 
 	/* Skip starting quote */
-	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
+	for (; parser->pos < len; parser->pos++) {
+		/* Skip ahead to the next quote, backslash, or null */
+		parser->pos = jsmn_scan_string(js, parser->pos, len);
+		if (parser->pos >= len || js[parser->pos] == '\0') {
+			break;
+		}
 		char c = js[parser->pos];
 
 		/* Quote: end of string */
@@ -1255,6 +2971,7 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
 				return JSMN_ERROR_NOMEM;
 			}
 			jsmn_fill_token(token, JSMN_STRING, start+1, parser->pos);
+			token->escaped = escaped;
 #ifdef JSMN_PARENT_LINKS
 			token->parent = parser->toksuper;
 #endif
@@ -1264,6 +2981,7 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
 		/* Backslash: Quoted symbol expected */
 		if (c == '\\' && parser->pos + 1 < len) {
 			int i;
+			escaped = true;
 			parser->pos++;
 			switch (js[parser->pos]) {
 				/* Allowed escaped symbols */
@@ -1306,6 +3024,13 @@ int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 	jsmntok_t *token;
 	int count = parser->toknext;
 
+#ifdef JSMN_COMPACT_TOKENS
+	/* Offsets must fit in a token, with JSMN_POS_INVALID left over */
+	if (len >= JSMN_POS_INVALID) {
+		return JSMN_ERROR_INVAL;
+	}
+#endif
+
 	for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
 		char c;
 		jsmntype_t type;
@@ -1317,11 +3042,15 @@ int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 				if (tokens == NULL) {
 					break;
 				}
+				if (parser->depth >= JSMN_MAX_DEPTH) {
+					return JSMN_ERROR_DEPTH;
+				}
 				token = jsmn_alloc_token(parser, tokens, num_tokens);
 				if (token == NULL)
 					return JSMN_ERROR_NOMEM;
 				if (parser->toksuper != -1) {
-					tokens[parser->toksuper].size++;
+					if (!jsmn_add_child(&tokens[parser->toksuper]))
+						return JSMN_ERROR_INVAL;
 #ifdef JSMN_PARENT_LINKS
 					token->parent = parser->toksuper;
 #endif
@@ -1329,62 +3058,33 @@ int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 				token->type = (c == '{' ? JSMN_OBJECT : JSMN_ARRAY);
 				token->start = parser->pos;
 				parser->toksuper = parser->toknext - 1;
+				parser->stack[parser->depth++] = parser->toksuper;
 				break;
 			case '}': case ']':
 				if (tokens == NULL)
 					break;
 				type = (c == '}' ? JSMN_OBJECT : JSMN_ARRAY);
-#ifdef JSMN_PARENT_LINKS
-				if (parser->toknext < 1) {
+				/* The innermost open container must be the same type */
+				if (parser->depth == 0) {
 					return JSMN_ERROR_INVAL;
 				}
-				token = &tokens[parser->toknext - 1];
-				for (;;) {
-					if (token->start != -1 && token->end == -1) {
-						if (token->type != type) {
-							return JSMN_ERROR_INVAL;
-						}
-						token->end = parser->pos + 1;
-						parser->toksuper = token->parent;
-						break;
-					}
-					if (token->parent == -1) {
-						if(token->type != type || parser->toksuper == -1) {
-							return JSMN_ERROR_INVAL;
-						}
-						break;
-					}
-					token = &tokens[token->parent];
-				}
-#else
-				for (i = parser->toknext - 1; i >= 0; i--) {
-					token = &tokens[i];
-					if (token->start != -1 && token->end == -1) {
-						if (token->type != type) {
-							return JSMN_ERROR_INVAL;
-						}
-						parser->toksuper = -1;
-						token->end = parser->pos + 1;
-						break;
-					}
-				}
-				/* Error if unmatched closing bracket */
-				if (i == -1) return JSMN_ERROR_INVAL;
-				for (; i >= 0; i--) {
-					token = &tokens[i];
-					if (token->start != -1 && token->end == -1) {
-						parser->toksuper = i;
-						break;
-					}
+				i = parser->stack[parser->depth - 1];
+				token = &tokens[i];
+				if (token->type != type) {
+					return JSMN_ERROR_INVAL;
 				}
-#endif
+				token->end = parser->pos + 1;
+				token->extent = parser->toknext - i;
+				parser->depth--;
+				parser->toksuper = (parser->depth > 0) ? parser->stack[parser->depth - 1] : -1;
 				break;
 			case '\"':
 				r = jsmn_parse_string(parser, js, len, tokens, num_tokens);
 				if (r < 0) return r;
 				count++;
-				if (parser->toksuper != -1 && tokens != NULL)
-					tokens[parser->toksuper].size++;
+				if (parser->toksuper != -1 && tokens != NULL &&
+						!jsmn_add_child(&tokens[parser->toksuper]))
+					return JSMN_ERROR_INVAL;
 				break;
 			case '\t' : case '\r' : case '\n' : case ' ':
 				break;
@@ -1395,18 +3095,7 @@ int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 				if (tokens != NULL && parser->toksuper != -1 &&
 						tokens[parser->toksuper].type != JSMN_ARRAY &&
 						tokens[parser->toksuper].type != JSMN_OBJECT) {
-#ifdef JSMN_PARENT_LINKS
-					parser->toksuper = tokens[parser->toksuper].parent;
-#else
-					for (i = parser->toknext - 1; i >= 0; i--) {
-						if (tokens[i].type == JSMN_ARRAY || tokens[i].type == JSMN_OBJECT) {
-							if (tokens[i].start != -1 && tokens[i].end == -1) {
-								parser->toksuper = i;
-								break;
-							}
-						}
-					}
-#endif
+					parser->toksuper = (parser->depth > 0) ? parser->stack[parser->depth - 1] : -1;
 				}
 				break;
 #ifdef JSMN_STRICT
@@ -1429,8 +3118,9 @@ int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 				r = jsmn_parse_primitive(parser, js, len, tokens, num_tokens);
 				if (r < 0) return r;
 				count++;
-				if (parser->toksuper != -1 && tokens != NULL)
-					tokens[parser->toksuper].size++;
+				if (parser->toksuper != -1 && tokens != NULL &&
+						!jsmn_add_child(&tokens[parser->toksuper]))
+					return JSMN_ERROR_INVAL;
 				break;
 
 #ifdef JSMN_STRICT
@@ -1441,13 +3131,9 @@ int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 		}
 	}
 
-	if (tokens != NULL) {
-		for (i = parser->toknext - 1; i >= 0; i--) {
-			/* Unmatched opened object or array */
-			if (tokens[i].start != -1 && tokens[i].end == -1) {
-				return JSMN_ERROR_PART;
-			}
-		}
+	if (tokens != NULL && parser->depth > 0) {
+		/* Unmatched opened object or array */
+		return JSMN_ERROR_PART;
 	}
 
 	return count;
@@ -1461,6 +3147,7 @@ void jsmn_init(jsmn_parser *parser) {
 	parser->pos = 0;
 	parser->toknext = 0;
 	parser->toksuper = -1;
+	parser->depth = 0;
 }
 }
 
@@ -4,6 +4,7 @@
 
 #include "Particle.h"
 
+#include <functional>
 #include <vector>
 
 // You can mostly ignore the stuff in this namespace block. It's part of the jsmn library
@@ -30,21 +31,68 @@ namespace JsonParserGeneratorRK {
 	enum jsmnerr {
 		JSMN_ERROR_NOMEM = -1,	//!< Not enough tokens were provided
 		JSMN_ERROR_INVAL = -2,	//!< Invalid character inside JSON string
-		JSMN_ERROR_PART = -3	//!< The string is not a full JSON packet, more bytes expected
+		JSMN_ERROR_PART = -3,	//!< The string is not a full JSON packet, more bytes expected
+		JSMN_ERROR_DEPTH = -4	//!< Objects and arrays are nested more than JSMN_MAX_DEPTH levels
 	};
 
+#ifndef JSMN_MAX_DEPTH
+	/**
+	 * @brief Maximum nesting depth of objects and arrays. Define this before compiling to change it.
+	 *
+	 * Each level uses 4 bytes in jsmn_parser (and JsonParser).
+	 */
+#define JSMN_MAX_DEPTH 16
+#endif
+
+#ifdef JSMN_COMPACT_TOKENS
+	/**
+	 * @brief Type used for offsets in tokens
+	 *
+	 * When compiled with JSMN_COMPACT_TOKENS, offsets are 16 bits and tokens are 8 bytes instead of 20.
+	 * JSMN_PARENT_LINKS adds 4 bytes to each token in either layout.
+	 * The data to parse must then be less than 65535 bytes and each object or array can contain at most
+	 * JSMN_SIZE_MAX elements; larger data fails to parse.
+	 */
+	typedef uint16_t jsmnpos_t;
+	const jsmnpos_t JSMN_POS_INVALID = 0xffff; //!< start or end not set yet
+	const int JSMN_SIZE_MAX = 0x0fff; //!< maximum size of an object or array token
+
+	/**
+	 * @brief JSON token description.
+	 */
+	typedef struct {
+		jsmnpos_t start;	//!< start position in JSON data string
+		jsmnpos_t end;		//!< end position in JSON data string
+		jsmnpos_t extent;	//!< number of tokens in this token's subtree, including itself. The next sibling is at this + extent.
+		jsmntype_t type : 3;	//!< type (object, array, string etc.)
+		unsigned int escaped : 1;	//!< string contains backslash escapes
+		unsigned int size : 12;	//!< size
+	#ifdef JSMN_PARENT_LINKS
+		int parent;			//!< parent object
+	#endif
+	} jsmntok_t;
+#else
+	/**
+	 * @brief Type used for offsets in tokens
+	 */
+	typedef int jsmnpos_t;
+	const jsmnpos_t JSMN_POS_INVALID = -1; //!< start or end not set yet
+
 	/**
 	 * @brief JSON token description.
 	 */
 	typedef struct {
-		jsmntype_t type;	//!< type (object, array, string etc.)
+		jsmntype_t type : 8;	//!< type (object, array, string etc.)
+		unsigned int escaped : 1;	//!< string contains backslash escapes
 		int start;			//!< start position in JSON data string
 		int end;			//!< end position in JSON data string
 		int size;			//!< size
+		int extent;			//!< number of tokens in this token's subtree, including itself. The next sibling is at this + extent.
 	#ifdef JSMN_PARENT_LINKS
 		int parent;			//!< parent object
 	#endif
 	} jsmntok_t;
+#endif
 
 	/**
 	 * @brief JSON parser
@@ -56,6 +104,8 @@ namespace JsonParserGeneratorRK {
 		unsigned int pos; 		//!< offset in the JSON string
 		unsigned int toknext;	//!< next token to allocate
 		int toksuper; 			//!< superior token node, e.g parent object or array
+		unsigned int depth;		//!< number of open objects and arrays
+		int stack[JSMN_MAX_DEPTH]; //!< token indexes of the open objects and arrays, innermost last
 	} jsmn_parser;
 
 	/**
@@ -72,6 +122,14 @@ namespace JsonParserGeneratorRK {
 	int jsmn_parse(jsmn_parser *parser, const char *js, size_t len,
 			jsmntok_t *tokens, unsigned int num_tokens);
 
+	/**
+	 * @brief Find the next quote, backslash, or null byte in a JSON string.
+	 *
+	 * Used by jsmn_parse and JsonSaxParser to skip over string contents.
+	 * Returns len if there isn't one before len.
+	 */
+	unsigned int jsmn_scan_string(const char *js, unsigned int pos, size_t len);
+
 	// end jsmn.h
 }
 
@@ -189,6 +247,34 @@ public:
 	 */
 	bool allocate(size_t len);
 
+	/**
+	 * @brief Makes sure the buffer can hold at least len bytes without reallocating
+	 *
+	 * @param len The length of the buffer in bytes
+	 *
+	 * @returns true if the buffer is already at least this large or was reallocated, false if using a static
+	 * buffer that is too small, there was not enough free memory, or len is larger than the maximum buffer length.
+	 *
+	 * Use this before adding data when you know about how large it will be to avoid reallocations.
+	 */
+	bool reserve(size_t len);
+
+	/**
+	 * @brief Reallocates a dynamically allocated buffer to the size of the data it contains
+	 *
+	 * One byte is kept after the data for a null terminator. Does nothing for a static buffer.
+	 */
+	void shrinkToFit();
+
+	/**
+	 * @brief Sets the maximum size a dynamically allocated buffer can grow to
+	 *
+	 * @param maxBufferLen Maximum length in bytes, or 0 for no limit (the default)
+	 *
+	 * Adding data that would make the buffer larger than this fails instead.
+	 */
+	void setMaxBufferLen(size_t maxBufferLen) { this->maxBufferLen = maxBufferLen; }
+
 	/**
 	 * @brief Add a c-string to the end of the buffer
 	 *
@@ -222,8 +308,32 @@ public:
 	 * - Chunks may arrive out-of-order.
 	 * - Event names end in /0 for the first chunk, /1 for the second, ... with the number being
 	 * a decimal number in ASCII, limited only by available RAM.
+	 *
+	 * A chunk shorter than chunkSize is the last chunk. Returns false without storing the data if a
+	 * chunk does not fit with the ones already received, such as a second short chunk or a chunk
+	 * after the last one.
+	 *
+	 * The received chunks are tracked so isComplete() can tell when all of them have arrived.
 	 */
 	bool addChunkedData(const char *event, const char *data, size_t chunkSize = 512);
+
+	/**
+	 * @brief Sets the number of chunks in a chunked response, if known
+	 *
+	 * addChunkedData() can only tell which chunk is the last one when it's shorter than chunkSize.
+	 * If the data could be an exact multiple of chunkSize, call this so isComplete() knows when it's done.
+	 */
+	void setChunkCount(size_t numChunks);
+
+	/**
+	 * @brief Returns true once all chunks of a chunked response have been added using addChunkedData()
+	 *
+	 * This is true once the last chunk (a short chunk, or the one set by setChunkCount()) and all of the
+	 * chunks before it have been received, so you only need to call parse() once. It's false if the last
+	 * chunk is not known yet, or is beyond MAX_TRACKED_CHUNKS; in that case call parse() after each
+	 * chunk instead.
+	 */
+	bool isComplete() const;
 	
 	/**
 	 * @brief Gets a pointer to the internal buffer
@@ -253,19 +363,41 @@ public:
 	/**
 	 * @brief Clears the current buffer for writing.
 	 *
-	 * This sets the offset to 0 and also zeroes all of the bytes.
+	 * This sets the offset to 0 and forgets the chunks added by addChunkedData(). The bytes in the
+	 * buffer are not zeroed, so this takes the same time regardless of the buffer size.
 	 */
-	void clear();
+	virtual void clear();
 
 	/**
 	 * @brief Null terminates the buffer
 	 */
 	void nullTerminate();
 
+	/**
+	 * @brief Minimum size of a dynamically allocated buffer when it grows
+	 */
+	static const size_t MIN_HEAP_BUFFER = 64;
+
+	/**
+	 * @brief Maximum number of chunks tracked by isComplete(), 32K with 512 byte chunks
+	 */
+	static const size_t MAX_TRACKED_CHUNKS = 64;
+
 protected:
+	/**
+	 * @brief Used internally to make room for at least len bytes when adding data
+	 *
+	 * A dynamically allocated buffer is grown geometrically, so adding data in n small pieces
+	 * only causes O(log n) reallocations.
+	 */
+	bool grow(size_t len);
+
 	char	*buffer; //!< The buffer to to read from or write to. This is not null-terminated.
 	size_t	bufferLen; //!< The length of the buffer in bytes,
 	size_t	offset; //!< The read or write offset.
+	size_t	maxBufferLen; //!< Maximum length a dynamically allocated buffer can grow to, or 0 for no limit
+	uint64_t chunksReceived; //!< Bit n is set when chunk n has been added by addChunkedData()
+	int		finalChunk; //!< Index of the last chunk, or -1 if not known yet
 	bool 	staticBuffers; //!< True if the buffers were passed in and should not freed or reallocated.
 
 };
@@ -317,9 +449,47 @@ public:
 	 * When parsing data split into multiple chunks as a webhook response you can call addString()
 	 * in your webhook subscription handler and call parse after each chunk. Only on the last chunk
 	 * will parse return true, and you'll know the entire reponse has been received.
+	 *
+	 * When using dynamically allocated tokens, the data is only scanned once. If the token array
+	 * fills up it's doubled in size and parsing continues where it left off. The token array is
+	 * kept across clear() and parse() so parsing similar data again does not allocate memory.
 	 */
 	bool parse();
 
+	/**
+	 * @brief Parses the data like parse(), then decodes and null terminates every string in place
+	 *
+	 * Backslash escapes in strings are decoded in the buffer and the token end is adjusted to match,
+	 * so after this every string and primitive value can be read with getTokenCString() or
+	 * getTokenView() without copying or decoding. This is useful for data that is parsed once and
+	 * read many times.
+	 *
+	 * This modifies the data in the buffer so it's no longer valid JSON. Don't call parse() again
+	 * on the same data, and don't use getTokenJsonString() on objects or arrays or JsonModifier
+	 * afterwards. A string containing \u0000 is cut short when read as a c-string.
+	 */
+	bool parseInSitu();
+
+	/**
+	 * @brief Parses the data added since the last call, continuing from where the last call stopped
+	 *
+	 * This is intended to be called after each addChunkedData() or addData() call for a multipart
+	 * webhook response. Unlike parse(), which scans the whole buffer each time, the parser state and
+	 * tokens are kept between calls so each byte is only tokenized once. Scanning stops at the end of
+	 * the data or at a gap left by a chunk that has not arrived yet.
+	 *
+	 * @return true once the top-level object or array is complete and the tokens can be used, false
+	 * if more data is needed or the data is not valid JSON.
+	 *
+	 * Call clear() to start over with new data. Calling parse() also starts over.
+	 */
+	bool parseIncremental();
+
+	/**
+	 * @brief Clears the data buffer and the incremental parsing state
+	 */
+	virtual void clear() override;
+
 	/**
 	 * @brief Get a JsonReference object. This is used for fluent-style access to the data.
 	 */
@@ -553,6 +723,38 @@ public:
 	 */
 	bool getValueTokenByKey(const JsonParserGeneratorRK::jsmntok_t *container, const char *key, const JsonParserGeneratorRK::jsmntok_t *&value) const;
 
+	/**
+	 * @brief Compares the value of a string token to a c-string. Used internally.
+	 *
+	 * @param token The token to compare. Escapes in the token are decoded before comparing.
+	 *
+	 * @param str The string to compare to. Does not need to be null-terminated.
+	 *
+	 * @param strLen The length of str in bytes.
+	 *
+	 * @return true if the decoded token value is the same as str.
+	 *
+	 * This compares the data in the buffer directly and does not allocate memory.
+	 */
+	bool tokenEquals(const JsonParserGeneratorRK::jsmntok_t *token, const char *str, size_t strLen) const;
+
+	/**
+	 * @brief Sets a buffer to hold hash indexes of objects for faster lookups by key
+	 *
+	 * @param keyIndex The buffer. It is not freed when the parser is destroyed.
+	 *
+	 * @param keyIndexLen The number of entries in keyIndex
+	 *
+	 * This is optional. If you look up many keys in the same large object, the first lookup in an
+	 * object builds a hash table of its keys in this buffer and later lookups use it instead of
+	 * searching the object. The indexes are discarded by parse().
+	 *
+	 * Only objects with at least KEY_INDEX_MIN_KEYS keys are indexed. Each indexed object uses
+	 * 2 entries plus a power of 2 entries at least twice the number of keys, so an object with
+	 * 20 keys uses 2 + 64 entries. If the buffer is full, a linear search is used instead.
+	 */
+	void setKeyIndexBuffer(int32_t *keyIndex, size_t keyIndexLen);
+
 	/**
 	 * @brief Given an array token in container, gets the token value with the specified index.
 	 *
@@ -628,7 +830,8 @@ public:
 	 *
 	 * For simple primitives and strings, this is equivalent to obj++. For objects and arrays,
 	 * however, this skips over the entire object or array, including any nested objects within
-	 * them.
+	 * them. This uses the extent stored in the token by the tokenizer so it does not need to
+	 * look at the nested tokens.
 	 */
 	bool skipObject(const JsonParserGeneratorRK::jsmntok_t *container, const JsonParserGeneratorRK::jsmntok_t *&obj) const;
 
@@ -657,6 +860,9 @@ public:
 	 *
 	 * Normally you'd use getValueByKey(), getValueByIndex() or getValueByColRow() which will automatically
 	 * use this when the result parameter is an int variable.
+	 *
+	 * Parsing stops at the first character that's not a digit, so 12.5 returns 12. Returns false if
+	 * there are no digits or the value does not fit in an int.
 	 */
 	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, int &result) const;
 
@@ -665,6 +871,8 @@ public:
 	 *
 	 * Normally you'd use getValueByKey(), getValueByIndex() or getValueByColRow() which will automatically
 	 * use this when the result parameter is an unsigned long variable.
+	 *
+	 * Returns false if there are no digits, the value is negative, or it does not fit in an unsigned long.
 	 */
 	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, unsigned long &result) const;
 
@@ -673,6 +881,8 @@ public:
 	 *
 	 * Normally you'd use getValueByKey(), getValueByIndex() or getValueByColRow() which will automatically
 	 * use this when the result parameter is a float variable.
+	 *
+	 * The result is the closest float to the decimal value. Returns false if the value is not a number.
 	 */
 	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, float &result) const;
 
@@ -681,6 +891,8 @@ public:
 	 *
 	 * Normally you'd use getValueByKey(), getValueByIndex() or getValueByColRow() which will automatically
 	 * use this when the result parameter is a double variable.
+	 *
+	 * The result is the closest double to the decimal value. Returns false if the value is not a number.
 	 */
 	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, double &result) const;
 
@@ -715,6 +927,35 @@ public:
 	 */
 	bool getTokenValue(const JsonParserGeneratorRK::jsmntok_t *token, JsonParserString &str) const;
 
+	/**
+	 * @brief Gets a pointer to a string token's value in the parser buffer, without copying it.
+	 *
+	 * @param token The token to get
+	 *
+	 * @param str Filled in with a pointer to the value in the buffer. It is not null terminated.
+	 *
+	 * @param strLen Filled in with the length of the value in bytes.
+	 *
+	 * @return true if str and strLen are the value. false if the value contains backslash escapes, in which
+	 * case str and strLen are the undecoded bytes and you need to use getTokenValue() to decode it.
+	 *
+	 * The pointer is valid until the buffer is modified or parsed again.
+	 */
+	bool getTokenView(const JsonParserGeneratorRK::jsmntok_t *token, const char *&str, size_t &strLen) const;
+
+	/**
+	 * @brief Gets a string or primitive value as a c-string in the parser buffer, after parseInSitu()
+	 *
+	 * @return Pointer to the null terminated value in the buffer, or NULL if the value is not null
+	 * terminated in the buffer, such as when the data was parsed with parse() instead of parseInSitu().
+	 */
+	const char *getTokenCString(const JsonParserGeneratorRK::jsmntok_t *token) const;
+
+	/**
+	 * @brief Returns true if the token contains backslash escapes that need to be decoded
+	 */
+	bool tokenHasEscapes(const JsonParserGeneratorRK::jsmntok_t *token) const;
+
 	/**
 	 * @brief Converts a token (object, array, string, or primitive) back into JSON in a Wiring String.
 	 *
@@ -767,11 +1008,103 @@ public:
 	 */
 	static void appendUtf8(uint16_t unicode, JsonParserString &str);
 
+	/**
+	 * @brief Given a Unicode UTF-16 code point, converts it to UTF-8 in dst.
+	 *
+	 * @param unicode The code point to convert
+	 *
+	 * @param dst Buffer to write to. Must be at least 3 bytes. It is not null-terminated.
+	 *
+	 * @return The number of bytes written to dst (1 - 3).
+	 */
+	static size_t encodeUtf8(uint16_t unicode, char *dst);
+
+	/**
+	 * @brief Decodes a JSON backslash escape. Used internally.
+	 *
+	 * @param src Pointer to the character after the backslash
+	 *
+	 * @param srcEnd Pointer to the end of the string being decoded
+	 *
+	 * @param dst Buffer to write the decoded character to. Must be at least 3 bytes. It is not null-terminated.
+	 *
+	 * @param dstLen Filled in with the number of bytes written to dst (0 - 3).
+	 *
+	 * @return Pointer to the character after the escape sequence.
+	 *
+	 * \\uXXXX escapes are converted to UTF-8.
+	 */
+	static const char *decodeEscape(const char *src, const char *srcEnd, char *dst, size_t &dstLen);
+
+	/**
+	 * @brief Minimum number of tokens allocated when tokens are dynamically allocated
+	 */
+	static const size_t MIN_HEAP_TOKENS = 16;
+
+	/**
+	 * @brief Objects with fewer keys than this are searched linearly instead of using the key index
+	 */
+	static const int KEY_INDEX_MIN_KEYS = 8;
+
+	/**
+	 * @brief Initial value for hashKey()
+	 */
+	static const uint32_t HASH_KEY_INITIAL = 2166136261;
+
+	/**
+	 * @brief Hashes a key name for the key index. Used internally.
+	 *
+	 * @param str The key name. Does not need to be null-terminated.
+	 *
+	 * @param strLen The length of the key name in bytes
+	 *
+	 * @param hash The hash to continue from, for hashing a key in pieces
+	 */
+	static uint32_t hashKey(const char *str, size_t strLen, uint32_t hash = HASH_KEY_INITIAL);
+
 protected:
+	/**
+	 * @brief Used internally to double the size of dynamically allocated token storage
+	 *
+	 * @return true if the tokens were reallocated, false if using static buffers or out of memory
+	 */
+	bool growTokens();
+
+	/**
+	 * @brief Used internally to run jsmn_parse from the current parser state, growing the tokens as needed
+	 *
+	 * @return The jsmn_parse result: number of tokens or a JSMN_ERROR value.
+	 */
+	int runParser();
+
+	/**
+	 * @brief Used internally to parse a float or double with strtod or strtof when the fast path can't be used
+	 *
+	 * Exactly one of doubleResult and floatResult must be non-NULL.
+	 */
+	bool parseTokenWithStrtod(const JsonParserGeneratorRK::jsmntok_t *token, double *doubleResult, float *floatResult) const;
+
+	/**
+	 * @brief Used internally to find or build the key index for an object
+	 *
+	 * @return Pointer to the index (container token index, number of slots, slots) or NULL
+	 * if there is no room for it in the key index buffer.
+	 */
+	const int32_t *getKeyIndex(const JsonParserGeneratorRK::jsmntok_t *container) const;
+
+	/**
+	 * @brief Used internally to hash the decoded value of a key token
+	 */
+	uint32_t hashToken(const JsonParserGeneratorRK::jsmntok_t *token) const;
+
 	JsonParserGeneratorRK::jsmntok_t *tokens; //!< Array of tokens after parsing.
 	JsonParserGeneratorRK::jsmntok_t *tokensEnd; //!< Pointer into tokens, points after last used token.
 	size_t	maxTokens; //!< Number of tokens that can be stored in tokens.
 	JsonParserGeneratorRK::jsmn_parser parser;//!< The JSMN parser object.
+	int32_t *keyIndex; //!< Buffer for object key indexes, set by setKeyIndexBuffer(). May be NULL.
+	size_t keyIndexLen; //!< Number of entries in keyIndex
+	mutable size_t keyIndexUsed; //!< Number of entries in keyIndex used by indexes built since the last parse()
+	bool incrementalStarted; //!< True if parser holds the state of a parseIncremental() in progress
 
 	friend class JsonModifier; // To access the tokens for modifying a JSON object in place
 };
@@ -911,150 +1244,384 @@ public:
 	 */
 	String valueString() const;
 
+	/**
+	 * @brief Gets a pointer to a string value in the parser buffer, without copying it
+	 *
+	 * @return true if str and strLen were filled in. false if the key or array index is not found, or the
+	 * value contains backslash escapes; use valueString() or value() to decode those.
+	 *
+	 * See JsonParser::getTokenView().
+	 */
+	bool valueView(const char *&str, size_t &strLen) const;
+
+	/**
+	 * @brief Returns a string value as a c-string in the parser buffer, after JsonParser::parseInSitu()
+	 *
+	 * @param defaultValue Value to return if the key or array index is not found, or the data was not
+	 * parsed with parseInSitu(). Default: "".
+	 */
+	const char *valueCString(const char *defaultValue = "") const;
+
 private:
 	const JsonParser *parser;
 	const JsonParserGeneratorRK::jsmntok_t *token;
 };
 
 /**
- * @brief Used internally by JsonWriter
- */
-typedef struct {
-	bool isFirst;		//!< True if this the first element in this object or array and doesn't need a comma before it
-	char terminator;	//!< The character that will terminate the object or array when ended
-} JsonWriterContext;
-
-/**
- * @brief Class for building a JSON string
+ * @brief Reassembles chunked webhook responses for several events at the same time
+ *
+ * JsonParser::addChunkedData() assumes only one response is in progress. When several webhooks are
+ * triggered at once, the chunks of their hook-response events can be interleaved. This class routes
+ * each chunk to a parser for its event name (the event name without the /0, /1, ... at the end),
+ * parses each response once all of its chunks have been received, and calls the completion
+ * callback with the parser.
+ *
+ * Responses that don't receive a chunk for the timeout period are discarded so their parser can be
+ * reused. This is checked when chunks are added and when you call loop().
+ *
+ * The parsers can be dynamically allocated, up to a maximum number, or you can use
+ * JsonChunkReassemblerStatic to use a fixed pool of JsonParserStatic objects.
  */
-class JsonWriter : public JsonBuffer {
+class JsonChunkReassembler {
 public:
 	/**
-	 * @brief Construct a JsonWriter with a dynamically allocated buffer
+	 * @brief Callback function called when a response is complete
 	 *
-	 * The buffer will be resized as necessary but you can improve efficiency by using the allocate() method
-	 * of JsonBuffer to pre-allocate space rather than have to incrementally make it bigger as it's written to.
-	 *
-	 * Use getBuffer() to get the pointer to the buffer and getOffset() to get the buffer pointer and size. The
-	 * buffer is not null-terminated!
-	 */
-	JsonWriter();
-
-	/**
-	 * @brief Destroy the object. If the buffer was dynamically allocated it will be freed.
+	 * @param eventName The event name, without the chunk number at the end
 	 *
-	 * If the buffer was passed in using the buffer, bufferLen constructor the buffer is not freed by this call
-	 * as it's likely statically allocated.
+	 * @param parser The parser containing the complete response, already parsed. It's cleared
+	 * and reused after the callback returns, so make a copy of any data you need to keep.
 	 */
-	virtual ~JsonWriter();
+	typedef std::function<void(const char *eventName, JsonParser &parser)> CompletionCallback;
 
 	/**
-	 * @brief Construct a JsonWriter to write to a static buffer
+	 * @brief Construct a reassembler that dynamically allocates parsers as needed
 	 *
-	 * @param buffer Pointer to the buffer
+	 * @param maxResponses The maximum number of responses that can be in progress at the same time
 	 *
-	 * @param bufferLen Length of the buffer in bytes
+	 * @param maxBufferLen The maximum size of each response in bytes, or 0 for no limit.
 	 *
+	 * Parsers are allocated the first time they're needed and kept for reuse.
 	 */
-	JsonWriter(char *buffer, size_t bufferLen);
+	JsonChunkReassembler(size_t maxResponses, size_t maxBufferLen = 0);
 
 	/**
-	 * @brief Reset the writer, clearing all data
-	 *
-	 * You do not need to call init() as it's called from the two constructors. You can call it again
-	 * if you want to reset the writer and reuse it, such as when you use JsonWriterStatic in a global
-	 * variable.
+	 * @brief Destructor. Deletes dynamically allocated parsers.
 	 */
-	void init();
+	virtual ~JsonChunkReassembler();
 
 	/**
-	 * @brief Start a new JSON object. Make sure you finish it with finishObjectOrArray()
+	 * @brief Sets the function to call when a response is complete
 	 */
-	bool startObject() { return startObjectOrArray('{', '}'); };
+	void setCompletionCallback(CompletionCallback completionCallback) { this->completionCallback = completionCallback; }
 
 	/**
-	 * @brief Start a new JSON array. Make sure you finish it with finishObjectOrArray()
+	 * @brief Sets how long to wait for the next chunk before discarding a response, in milliseconds
+	 *
+	 * The default is DEFAULT_TIMEOUT_MS (30 seconds).
 	 */
-	bool startArray() { return startObjectOrArray('[', ']'); };
+	void setTimeout(unsigned long timeoutMs) { this->timeoutMs = timeoutMs; }
 
 	/**
-	 * @brief Finsh an object or array started with startObject() or startArray()
+	 * @brief Add chunked multipart data, typically from an event subscription handler
+	 *
+	 * @param event The event name, ending in /0, /1, ... for the chunk number
+	 *
+	 * @param data The event data (c-string)
+	 *
+	 * @param chunkSize The size of all chunks except the last one (default: 512 bytes)
+	 *
+	 * @return true if the chunk was added. false if the event name is too long, all parsers are in use
+	 * by other responses, or the parser rejected the data. If the parser rejected the data, or the
+	 * complete response is not valid JSON, the response is discarded.
+	 *
+	 * If this was the last chunk needed, the completion callback is called before this returns.
 	 */
-	void finishObjectOrArray();
+	bool addChunkedData(const char *event, const char *data, size_t chunkSize = 512);
 
 	/**
-	 * @brief Inserts a boolean value ("true" or "false").
+	 * @brief Discards responses that have timed out
 	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separtators between items.
+	 * You don't need to call this, but if you do, from loop(), the parsers used by responses that
+	 * will never complete are freed up sooner.
 	 */
-	void insertValue(bool value);
+	void loop();
 
 	/**
-	 * @brief Inserts an integer value.
-	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separators between items.
+	 * @brief Returns the number of responses that have received some, but not all, of their chunks
 	 */
-	void insertValue(int value) { insertsprintf("%d", value); }
+	size_t getNumInProgress() const;
 
 	/**
-	 * @brief Inserts an unsigned integer value.
-	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separators between items.
+	 * @brief Maximum length of an event name, not including the chunk number
 	 */
-	void insertValue(unsigned int value) { insertsprintf("%u", value); }
+	static const size_t MAX_EVENT_NAME = 64;
 
 	/**
-	 * @brief Inserts a long integer value.
-	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separators between items.
+	 * @brief Default timeout in milliseconds
 	 */
-	void insertValue(long value) { insertsprintf("%ld", value); }
+	static const unsigned long DEFAULT_TIMEOUT_MS = 30000;
 
+protected:
 	/**
-	 * @brief Inserts an unsigned long integer value.
-	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separators between items.
+	 * @brief State of one response being reassembled
 	 */
-	void insertValue(unsigned long value) { insertsprintf("%lu", value); }
+	typedef struct {
+		JsonParser *parser; //!< Parser holding the data, or NULL if not allocated yet
+		unsigned long lastChunkMillis; //!< millis() value when the last chunk was added
+		bool inUse; //!< True if a response is in progress
+		char eventName[MAX_EVENT_NAME + 1]; //!< Event name without the chunk number
+	} Response;
 
 	/**
-	 * @brief Inserts a floating point value.
+	 * @brief Constructor used by JsonChunkReassemblerStatic
 	 *
-	 * Use setFloatPlaces() to set the number of decimal places to include.
+	 * @param responses Array of responses, with the parser of each one set.
 	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separtators between items.
+	 * @param numResponses The number of elements in responses
 	 */
-	void insertValue(float value);
+	JsonChunkReassembler(Response *responses, size_t numResponses);
 
 	/**
-	 * @brief Inserts a floating point double value.
+	 * @brief Used internally to find the response for an event name, or start a new one
 	 *
-	 * Use setFloatPlaces() to set the number of decimal places to include.
-	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separtators between items.
+	 * @return The response, or NULL if all of them are in use
 	 */
-	void insertValue(double value);
+	Response *findResponse(const char *eventName, size_t eventNameLen);
 
 	/**
-	 * @brief Inserts a quoted string value. This escapes special characters and encodes utf-8.
-	 *
-	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
-	 * as those functions take care of inserting the separtators between items.
+	 * @brief Used internally to discard a response so its parser can be reused
 	 */
-	void insertValue(const char *value) { insertString(value, true); }
+	void releaseResponse(Response *response);
 
-	/**
-	 * @brief Inserts a quoted string value.
-	 *
-	 * This escapes special characters and encodes utf-8.
-	 * See also the version that takes a plain const char *.
+	Response *responses; //!< Array of responses
+	size_t numResponses; //!< Number of elements in responses
+	size_t maxBufferLen; //!< Maximum size of a dynamically allocated parser buffer, or 0 for no limit
+	bool staticResponses; //!< True if the responses and parsers were passed in and should not be deleted
+	unsigned long timeoutMs; //!< Timeout in milliseconds
+	CompletionCallback completionCallback; //!< Function to call when a response is complete
+};
+
+/**
+ * @brief Creates a JsonChunkReassembler with a fixed pool of static parsers
+ *
+ * @param NUM_RESPONSES The maximum number of responses that can be in progress at the same time
+ *
+ * @param BUFFER_SIZE The maximum size of each response, in bytes
+ *
+ * @param MAX_TOKENS The maximum number of tokens in each response
+ */
+template <size_t NUM_RESPONSES, size_t BUFFER_SIZE, size_t MAX_TOKENS>
+class JsonChunkReassemblerStatic : public JsonChunkReassembler {
+public:
+	/**
+	 * @brief Construct a reassembler using the static parsers
+	 */
+	explicit JsonChunkReassemblerStatic() : JsonChunkReassembler(staticResponseArray, NUM_RESPONSES) {
+		for(size_t ii = 0; ii < NUM_RESPONSES; ii++) {
+			staticResponseArray[ii].parser = &staticParsers[ii];
+		}
+	};
+
+private:
+	Response staticResponseArray[NUM_RESPONSES]; //!< The responses
+	JsonParserStatic<BUFFER_SIZE, MAX_TOKENS> staticParsers[NUM_RESPONSES]; //!< The parsers used by the responses
+};
+
+/**
+ * @brief Used internally by JsonWriter
+ */
+typedef struct {
+	bool isFirst;		//!< True if this the first element in this object or array and doesn't need a comma before it
+	char terminator;	//!< The character that will terminate the object or array when ended
+} JsonWriterContext;
+
+/**
+ * @brief State of a JsonWriter saved by JsonWriter::checkpoint()
+ *
+ * The state of up to 32 nesting levels is saved. A checkpoint taken deeper than that can't be rolled back to.
+ */
+typedef struct {
+	size_t offset;			//!< Offset in the buffer
+	size_t contextIndex;	//!< Nesting depth
+	uint32_t isFirstBits;	//!< isFirst flags, bit n is level n
+	char terminators[32];	//!< terminator characters, element n is level n
+	size_t flushedLen;		//!< Number of bytes flushed to a sink
+	bool truncated;			//!< Truncated flag
+} JsonWriterCheckpoint;
+
+/**
+ * @brief Class for building a JSON string
+ */
+class JsonWriter : public JsonBuffer {
+public:
+	/**
+	 * @brief Construct a JsonWriter with a dynamically allocated buffer
+	 *
+	 * The buffer will be resized as necessary, doubling in size each time, but you can improve efficiency
+	 * by using the reserve() method of JsonBuffer to pre-allocate space. Use setMaxBufferLen() to limit how
+	 * large it can get; data past that is truncated.
+	 *
+	 * Use getBuffer() to get the pointer to the buffer and getOffset() to get the buffer pointer and size. The
+	 * buffer is not null-terminated!
+	 *
+	 * The stack of nested objects and arrays is also dynamically allocated when you start the first object
+	 * or array, and grows as needed, so there is no limit on the nesting depth.
+	 */
+	JsonWriter();
+
+	/**
+	 * @brief Destroy the object. If the buffer was dynamically allocated it will be freed.
+	 *
+	 * If the buffer was passed in using the buffer, bufferLen constructor the buffer is not freed by this call
+	 * as it's likely statically allocated.
+	 */
+	virtual ~JsonWriter();
+
+	/**
+	 * @brief Construct a JsonWriter to write to a static buffer
+	 *
+	 * @param buffer Pointer to the buffer
+	 *
+	 * @param bufferLen Length of the buffer in bytes
+	 *
+	 * The stack of nested objects and arrays is dynamically allocated when you start the first object or
+	 * array, and grows as needed. To avoid using the heap, pass a stack to the constructor below or use
+	 * JsonWriterStatic.
+	 */
+	JsonWriter(char *buffer, size_t bufferLen);
+
+	/**
+	 * @brief Construct a JsonWriter to write to a static buffer, with a static stack of nested objects and arrays
+	 *
+	 * @param buffer Pointer to the buffer
+	 *
+	 * @param bufferLen Length of the buffer in bytes
+	 *
+	 * @param context Pointer to the nesting stack
+	 *
+	 * @param contextSize Number of elements in context. The outer level uses one, so you can have contextSize - 1
+	 * objects or arrays nested in each other. Starting more sets the truncated flag.
+	 */
+	JsonWriter(char *buffer, size_t bufferLen, JsonWriterContext *context, size_t contextSize);
+
+	/**
+	 * @brief Reset the writer, clearing all data
+	 *
+	 * You do not need to call init() as it's called from the two constructors. You can call it again
+	 * if you want to reset the writer and reuse it, such as when you use JsonWriterStatic in a global
+	 * variable. Subclasses that have their own state override it.
+	 */
+	virtual void init();
+
+	/**
+	 * @brief Start a new JSON object. Make sure you finish it with finishObjectOrArray()
+	 */
+	bool startObject() { return startObjectOrArray('{', '}'); };
+
+	/**
+	 * @brief Start a new JSON array. Make sure you finish it with finishObjectOrArray()
+	 */
+	bool startArray() { return startObjectOrArray('[', ']'); };
+
+	/**
+	 * @brief Finsh an object or array started with startObject() or startArray()
+	 */
+	void finishObjectOrArray();
+
+	/**
+	 * @brief Inserts a boolean value ("true" or "false").
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separtators between items.
+	 */
+	void insertValue(bool value);
+
+	/**
+	 * @brief Inserts an integer value.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separators between items.
+	 */
+	void insertValue(int value) { insertSignedValue(value); }
+
+	/**
+	 * @brief Inserts an unsigned integer value.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separators between items.
+	 */
+	void insertValue(unsigned int value) { insertUnsignedValue(value); }
+
+	/**
+	 * @brief Inserts a long integer value.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separators between items.
+	 */
+	void insertValue(long value) { insertSignedValue(value); }
+
+	/**
+	 * @brief Inserts an unsigned long integer value.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separators between items.
+	 */
+	void insertValue(unsigned long value) { insertUnsignedValue(value); }
+
+	/**
+	 * @brief Inserts a long long (64-bit) integer value. This is also used for int64_t.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separators between items.
+	 */
+	void insertValue(long long value) { insertSignedValue(value); }
+
+	/**
+	 * @brief Inserts an unsigned long long (64-bit) integer value. This is also used for uint64_t.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separators between items.
+	 */
+	void insertValue(unsigned long long value) { insertUnsignedValue(value); }
+
+	/**
+	 * @brief Inserts a floating point value.
+	 *
+	 * By default the value is written with the fewest digits that convert back to the same float,
+	 * for example 1.1 instead of 1.100000. Use setFloatPlaces() to set a fixed number of decimal
+	 * places instead. NaN and infinity are written as null.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separtators between items.
+	 */
+	void insertValue(float value);
+
+	/**
+	 * @brief Inserts a floating point double value.
+	 *
+	 * By default the value is written with the fewest digits that convert back to the same double.
+	 * Use setFloatPlaces() to set a fixed number of decimal places instead. NaN and infinity are
+	 * written as null.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separtators between items.
+	 */
+	void insertValue(double value);
+
+	/**
+	 * @brief Inserts a quoted string value. This escapes special characters and encodes utf-8.
+	 *
+	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
+	 * as those functions take care of inserting the separtators between items.
+	 */
+	void insertValue(const char *value) { insertString(value, true); }
+
+	/**
+	 * @brief Inserts a quoted string value.
+	 *
+	 * This escapes special characters and encodes utf-8.
+	 * See also the version that takes a plain const char *.
 	 *
 	 * You would normally use insertKeyValue() or insertArrayValue() instead of calling this directly
 	 * as those functions take care of inserting the separtators between items.
@@ -1170,11 +1737,50 @@ public:
 	 */
 	bool isTruncated() const { return truncated; }
 
+	/**
+	 * @brief Saves the current position so you can undo what's written after it with rollback()
+	 *
+	 * This is used to fill a buffer with as many elements as will fit:
+	 *
+	 * ```
+	 * JsonWriterCheckpoint cp = jw.checkpoint();
+	 * jw.insertArrayValue(reading);
+	 * if (jw.isTruncated() || jw.getOffset() + jw.getNestingDepth() + 1 > jw.getBufferLen()) {
+	 *     // Does not fit with room to finish the open objects and arrays
+	 *     jw.rollback(cp);
+	 * }
+	 * ```
+	 */
+	JsonWriterCheckpoint checkpoint() const;
+
+	/**
+	 * @brief Restores the position, nesting, and truncated flag saved by checkpoint()
+	 *
+	 * @return true if restored, false if the data after the checkpoint was already sent to a sink, or
+	 * the checkpoint was taken more than 31 objects or arrays deep.
+	 *
+	 * Objects and arrays that were open at the checkpoint are reopened if they have been finished since.
+	 */
+	bool rollback(const JsonWriterCheckpoint &checkpoint);
+
+	/**
+	 * @brief Returns the number of objects and arrays that have been started but not finished
+	 */
+	size_t getNestingDepth() const { return contextIndex; }
+
+	/**
+	 * @brief Returns the number of bytes sent to a sink by flush(), since the writer was constructed or init() was called
+	 *
+	 * This is always 0 for a plain JsonWriter.
+	 */
+	size_t getFlushedLen() const { return flushedLen; }
+
 	/**
 	 * @brief Sets the number of digits for formatting float and double values.
 	 *
 	 * @param floatPlaces The number of decimal places for float and double.
-	 * Set it to -1 to use the default for snprintf. -1 is the default value if you don't call setFloatPlaces.
+	 * Set it to -1 to use the shortest representation that converts back to the same value. -1 is the
+	 * default value if you don't call setFloatPlaces.
 	 */
 	void setFloatPlaces(int floatPlaces) { this->floatPlaces = floatPlaces; }
 
@@ -1199,7 +1805,51 @@ public:
 	 *
 	 * Used internally. You should use insertKeyValue() or insertArrayValue() with a string instead.
 	 */
-	void insertChar(char ch);
+	void insertChar(char ch) {
+		if (offset < bufferLen || ensureSpace(1)) {
+			buffer[offset++] = ch;
+		}
+		else {
+			truncated = true;
+		}
+	}
+
+	/**
+	 * @brief Used internally to insert characters that don't need escaping
+	 *
+	 * If they don't all fit, the ones that fit are inserted and the truncated flag is set.
+	 */
+	void insertChars(const char *s, size_t len);
+
+	/**
+	 * @brief Used internally to check if there is room to insert len more bytes
+	 *
+	 * If there isn't, a dynamically allocated buffer is grown, otherwise flush() is called to make room.
+	 */
+	bool ensureSpace(size_t len);
+
+	/**
+	 * @brief Sends the data in the buffer to the output sink, if there is one, and empties the buffer
+	 *
+	 * @return true if the buffer was emptied. The plain JsonWriter has no sink and returns false, so
+	 * data that does not fit in the buffer is truncated.
+	 *
+	 * This is called when the buffer is full and when the outer object or array is finished.
+	 * JsonSinkWriter overrides it.
+	 */
+	virtual bool flush();
+
+	/**
+	 * @brief Used internally to insert a signed integer of any size
+	 */
+	void insertSignedValue(long long value);
+
+	/**
+	 * @brief Used internally to insert an unsigned integer of any size, with an optional minus sign
+	 *
+	 * The digits are written directly into the buffer two at a time using a lookup table.
+	 */
+	void insertUnsignedValue(unsigned long long value, bool negative = false);
 
 	/**
 	 * @brief Used to insert a string of existing JSON (typically a preformatted object or array) into a writer
@@ -1222,6 +1872,9 @@ public:
 	 * double instead.
 	 *
 	 * This method does not quote or escape the string - it's used mainly for formatting numbers.
+	 *
+	 * With a JsonSinkWriter or JsonChunkedWriter the formatted output must fit in the staging buffer;
+	 * longer output is truncated.
 	 */
 	void insertsprintf(const char *fmt, ...);
 
@@ -1232,6 +1885,9 @@ public:
 	 * double instead.
 	 *
 	 * This method does not quote or escape the string - it's used mainly for formatting numbers.
+	 *
+	 * With a JsonSinkWriter or JsonChunkedWriter the formatted output must fit in the staging buffer;
+	 * longer output is truncated.
 	 */
 	void insertvsprintf(const char *fmt, va_list ap);
 
@@ -1241,18 +1897,47 @@ public:
 	void setIsFirst(bool isFirst = true);
 
 	/**
-	 * This constant is the maximum number of nested objects that are supported; the actual number is
-	 * one less than this so when set to 9 you can have eight objects nested in each other.
+	 * This constant is the default nesting stack size for the static writer classes, and the initial size
+	 * of a dynamically allocated stack. The outer level uses one element, so when set to 9 you can have
+	 * eight objects nested in each other.
 	 *
-	 * Overhead is 8 bytes per nested context, so 9 elements is 72 bytes.
+	 * Overhead is 2 bytes per nested context, so 9 elements is 18 bytes.
 	 */
 	static const size_t MAX_NESTED_CONTEXT = 9;
 
+	/**
+	 * @brief Used internally to classify bytes in strings
+	 *
+	 * 0 if the byte can be copied as-is, 1 for a UTF-8 byte, 'u' for a control character that's
+	 * written as \u00XX, otherwise the character after the backslash in its escape.
+	 */
+	static const uint8_t stringEscapeClass[256];
+
 protected:
+	/**
+	 * @brief Sets a static nesting stack. Used by the static writer classes before anything is written.
+	 *
+	 * @param context Pointer to the nesting stack, or NULL to only allow the outer level
+	 *
+	 * @param contextSize Number of elements in context
+	 */
+	void setContextBuffer(JsonWriterContext *context, size_t contextSize);
+
+	/**
+	 * @brief Makes the nesting stack at least size elements, if it's dynamically allocated
+	 *
+	 * @return true if the stack is large enough, false if it's static or out of memory
+	 */
+	bool growContext(size_t size);
+
 	size_t contextIndex;							//!< Index into the context for the current level of nesting
-	JsonWriterContext context[MAX_NESTED_CONTEXT]; 	//!< Structure for managing nested objects
+	JsonWriterContext *context; 					//!< Stack for managing nested objects, contextSize elements
+	size_t contextSize;								//!< Number of elements in context
+	bool staticContext;								//!< True if context was passed in and should not be freed or reallocated
+	JsonWriterContext rootContext;					//!< Outer level, used until a stack is allocated or passed in
 	bool truncated; 								//!< true if data was added that didn't fit and was truncated
-	int floatPlaces; 								//!< default number of places to display for floating point numbers (default is -1, the default for sprintf)
+	size_t flushedLen;								//!< Number of bytes sent to a sink by flush()
+	int floatPlaces; 								//!< default number of places to display for floating point numbers (default is -1, shortest round-trip)
 };
 
 
@@ -1272,14 +1957,224 @@ protected:
  * variable.
  *
  * @param BUFFER_SIZE The size of the buffer to reserve.
+ *
+ * @param NESTING_DEPTH The size of the nesting stack, 2 bytes per element. The outer level uses one element,
+ * so the default of 9 allows eight objects or arrays nested in each other.
  */
-template <size_t BUFFER_SIZE>
+template <size_t BUFFER_SIZE, size_t NESTING_DEPTH = JsonWriter::MAX_NESTED_CONTEXT>
 class JsonWriterStatic : public JsonWriter {
 public:
-	explicit JsonWriterStatic() : JsonWriter(staticBuffer, BUFFER_SIZE) {};
+	explicit JsonWriterStatic() : JsonWriter(staticBuffer, BUFFER_SIZE, staticContextArray, NESTING_DEPTH) {};
 
 private:
 	char staticBuffer[BUFFER_SIZE]; //!< static buffer to write to
+	JsonWriterContext staticContextArray[NESTING_DEPTH]; //!< static nesting stack
+};
+
+/**
+ * @brief JsonWriter that sends its output to a sink instead of keeping it all in the buffer
+ *
+ * The buffer is only used for staging: whenever it fills up, and when the outer object or array is
+ * finished, its contents are sent to the sink and it's emptied. This makes it possible to write
+ * documents of any size in a small, fixed amount of RAM, for example to a TCPClient.
+ *
+ * The sink can be a Print object (TCPClient, Serial, File, ...) or a function. If the sink fails,
+ * the writer stops and isTruncated() returns true.
+ *
+ * Since the output is not all in the buffer, this can't be used with JsonModifier, and getBuffer()
+ * and getOffset() only return the data that has not been sent yet.
+ */
+class JsonSinkWriter : public JsonWriter {
+public:
+	/**
+	 * @brief Function that receives the output
+	 *
+	 * @param data Pointer to the data. It is not null terminated.
+	 *
+	 * @param dataLen Number of bytes of data
+	 *
+	 * @return true if the data was sent, or false to stop writing.
+	 */
+	typedef std::function<bool(const char *data, size_t dataLen)> SinkFunction;
+
+	/**
+	 * @brief Construct a writer that sends its output to a function
+	 *
+	 * @param buffer Staging buffer
+	 *
+	 * @param bufferLen Length of the staging buffer in bytes
+	 *
+	 * @param sink The function to send the data to
+	 */
+	JsonSinkWriter(char *buffer, size_t bufferLen, SinkFunction sink);
+
+	/**
+	 * @brief Construct a writer that sends its output to a Print object, such as a TCPClient
+	 *
+	 * @param buffer Staging buffer
+	 *
+	 * @param bufferLen Length of the staging buffer in bytes
+	 *
+	 * @param print The object to write to. It must exist as long as the writer does.
+	 */
+	JsonSinkWriter(char *buffer, size_t bufferLen, Print &print);
+
+	/**
+	 * @brief Destructor. Data not sent yet is not flushed.
+	 */
+	virtual ~JsonSinkWriter();
+
+	/**
+	 * @brief Sends the data in the staging buffer to the sink
+	 *
+	 * This is called automatically when the buffer fills up and when the outer object or array is
+	 * finished. Call it yourself if you insert values without an outer object or array.
+	 */
+	virtual bool flush() override;
+
+protected:
+	SinkFunction sink; //!< Function to send the data to
+};
+
+/**
+ * @brief Creates a JsonSinkWriter with a statically allocated staging buffer.
+ *
+ * @param BUFFER_SIZE The size of the staging buffer. Larger buffers mean fewer, larger writes to the sink.
+ *
+ * @param NESTING_DEPTH The size of the nesting stack, as for JsonWriterStatic
+ */
+template <size_t BUFFER_SIZE, size_t NESTING_DEPTH = JsonWriter::MAX_NESTED_CONTEXT>
+class JsonSinkWriterStatic : public JsonSinkWriter {
+public:
+	/**
+	 * @brief Construct a writer that sends its output to a function
+	 */
+	explicit JsonSinkWriterStatic(SinkFunction sink) : JsonSinkWriter(staticBuffer, BUFFER_SIZE, sink) {
+		setContextBuffer(staticContextArray, NESTING_DEPTH);
+	};
+
+	/**
+	 * @brief Construct a writer that sends its output to a Print object, such as a TCPClient
+	 */
+	explicit JsonSinkWriterStatic(Print &print) : JsonSinkWriter(staticBuffer, BUFFER_SIZE, print) {
+		setContextBuffer(staticContextArray, NESTING_DEPTH);
+	};
+
+private:
+	char staticBuffer[BUFFER_SIZE]; //!< static buffer used for staging
+	JsonWriterContext staticContextArray[NESTING_DEPTH]; //!< static nesting stack
+};
+
+/**
+ * @brief JsonWriter that splits its output into numbered chunks, such as for publishing events
+ *
+ * This is the inverse of JsonBuffer::addChunkedData(). The output is sent to a callback in chunks of
+ * exactly chunkSize bytes, except for the last one which can be shorter, along with an event name made
+ * from the prefix and the chunk number: prefix/0, prefix/1, ... On the receiving side, pass the events
+ * to addChunkedData() with the same chunkSize to reassemble the data.
+ *
+ * Full chunks are sent as soon as they're written. The last chunk is sent when the outer object or
+ * array is finished, so the data must be inside an object or array.
+ *
+ * The callback can wait until the chunk can be sent, such as for the publish rate limit, before
+ * returning. If it returns false, the writer stops and isTruncated() returns true.
+ */
+class JsonChunkedWriter : public JsonWriter {
+public:
+	/**
+	 * @brief Function that receives each chunk
+	 *
+	 * @param eventName The prefix followed by /0, /1, ...
+	 *
+	 * @param data The chunk data, null terminated
+	 *
+	 * @param dataLen The length of the data in bytes. This is chunkSize except for the last chunk.
+	 *
+	 * @return true if the chunk was sent, or false to stop writing
+	 */
+	typedef std::function<bool(const char *eventName, const char *data, size_t dataLen)> ChunkFunction;
+
+	/**
+	 * @brief Construct a chunked writer
+	 *
+	 * @param buffer Staging buffer. Must be larger than chunkSize; 2 * chunkSize + 1 avoids copying.
+	 *
+	 * @param bufferLen Length of the staging buffer in bytes
+	 *
+	 * @param eventNamePrefix The event name before the chunk number, at most MAX_EVENT_NAME_PREFIX characters.
+	 * It's copied so it does not need to remain valid.
+	 *
+	 * @param chunkSize The size of each chunk, except for the last one
+	 *
+	 * @param chunkFunction The function to call for each chunk
+	 */
+	JsonChunkedWriter(char *buffer, size_t bufferLen, const char *eventNamePrefix, size_t chunkSize, ChunkFunction chunkFunction);
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~JsonChunkedWriter();
+
+	/**
+	 * @brief Reset the writer to start a new document, starting again at chunk 0
+	 */
+	virtual void init() override;
+
+	/**
+	 * @brief Sends the full chunks in the staging buffer, and the last chunk after the outer object or array is finished
+	 *
+	 * This is called automatically.
+	 */
+	virtual bool flush() override;
+
+	/**
+	 * @brief Returns the number of chunks sent since the writer was constructed or init() was called
+	 */
+	size_t getNumChunks() const { return chunkIndex; }
+
+	/**
+	 * @brief Maximum length of the event name prefix
+	 */
+	static const size_t MAX_EVENT_NAME_PREFIX = 63;
+
+protected:
+	/**
+	 * @brief Used internally to send the chunk at start in the buffer
+	 */
+	bool sendChunk(size_t start, size_t len);
+
+	size_t chunkSize; //!< Size of each chunk except the last one
+	size_t chunkIndex; //!< Number of the next chunk to send
+	ChunkFunction chunkFunction; //!< Function to call for each chunk
+	char eventName[MAX_EVENT_NAME_PREFIX + 12]; //!< The prefix; the chunk number is added after it
+	size_t eventNamePrefixLen; //!< Length of the prefix in eventName
+};
+
+/**
+ * @brief Creates a JsonChunkedWriter with a statically allocated staging buffer
+ *
+ * @param CHUNK_SIZE The size of each chunk, except the last one
+ *
+ * @param NESTING_DEPTH The size of the nesting stack, as for JsonWriterStatic
+ */
+template <size_t CHUNK_SIZE, size_t NESTING_DEPTH = JsonWriter::MAX_NESTED_CONTEXT>
+class JsonChunkedWriterStatic : public JsonChunkedWriter {
+public:
+	/**
+	 * @brief Construct a chunked writer
+	 *
+	 * @param eventNamePrefix The event name before the chunk number
+	 *
+	 * @param chunkFunction The function to call for each chunk
+	 */
+	explicit JsonChunkedWriterStatic(const char *eventNamePrefix, ChunkFunction chunkFunction) :
+		JsonChunkedWriter(staticBuffer, sizeof(staticBuffer), eventNamePrefix, CHUNK_SIZE, chunkFunction) {
+		setContextBuffer(staticContextArray, NESTING_DEPTH);
+	};
+
+private:
+	char staticBuffer[2 * CHUNK_SIZE + 1]; //!< static buffer used for staging
+	JsonWriterContext staticContextArray[NESTING_DEPTH]; //!< static nesting stack
 };
 
 /**
@@ -1358,6 +2253,12 @@ protected:
  */
 class JsonModifier : public JsonWriter {
 public:
+	/**
+	 * @brief Construct a modifier for the data in a parser
+	 *
+	 * The modifier only stores the outer level of nesting. A stack is allocated on the heap the first
+	 * time you start an object or array with it.
+	 */
 	JsonModifier(JsonParser &jp);
 	virtual ~JsonModifier();
 
@@ -1487,6 +2388,131 @@ protected:
 	//bool addSeparator = false;	//!< Set by startAppend() and used by insertCheckSeparator()
 };
 
+/**
+ * @brief Handler for the events generated by JsonSaxParser
+ *
+ * Subclass this and override the methods for the events you are interested in. Each method returns
+ * true to continue parsing or false to stop; parse() then returns false. The default implementations
+ * ignore the event and continue.
+ *
+ * Strings, keys, and numbers are passed as a pointer into the parser buffer and a length in bytes.
+ * They are not null-terminated, and strings and keys are exactly as they appear in the JSON data,
+ * without the quotes but with any backslash escapes still encoded. JsonParser::decodeEscape() can be
+ * used to decode them.
+ */
+class JsonSaxHandler {
+public:
+	virtual ~JsonSaxHandler() {};
+
+	/**
+	 * @brief Called at the start of an object ({)
+	 */
+	virtual bool startObject() { return true; };
+
+	/**
+	 * @brief Called at the end of an object (})
+	 */
+	virtual bool endObject() { return true; };
+
+	/**
+	 * @brief Called at the start of an array ([)
+	 */
+	virtual bool startArray() { return true; };
+
+	/**
+	 * @brief Called at the end of an array (])
+	 */
+	virtual bool endArray() { return true; };
+
+	/**
+	 * @brief Called for the key of a key/value pair in an object. The value follows.
+	 */
+	virtual bool key(const char * /* str */, size_t /* len */) { return true; };
+
+	/**
+	 * @brief Called for a string value
+	 */
+	virtual bool string(const char * /* str */, size_t /* len */) { return true; };
+
+	/**
+	 * @brief Called for a number value. The number text can be an integer or a floating point value.
+	 */
+	virtual bool number(const char * /* str */, size_t /* len */) { return true; };
+
+	/**
+	 * @brief Called for true and false
+	 */
+	virtual bool boolean(bool /* value */) { return true; };
+
+	/**
+	 * @brief Called for null
+	 */
+	virtual bool null() { return true; };
+};
+
+/**
+ * @brief Parser that calls a JsonSaxHandler for each value instead of storing tokens
+ *
+ * This uses the same string scanner as JsonParser but does not use a token array. The only memory used
+ * besides the data buffer is a fixed few bytes of state, so it's useful for large data where you only
+ * need a few values. Nesting is limited to MAX_DEPTH levels of objects and arrays.
+ *
+ * Add data using addString(), addData(), or addChunkedData() the same as JsonParser, then call
+ * parse().
+ */
+class JsonSaxParser : public JsonBuffer {
+public:
+	/**
+	 * @brief Construct a SAX parser object with a dynamically allocated buffer
+	 */
+	JsonSaxParser();
+
+	/**
+	 * @brief Destroy a SAX parser object
+	 */
+	virtual ~JsonSaxParser();
+
+	/**
+	 * @brief Static buffer constructor
+	 */
+	JsonSaxParser(char *buffer, size_t bufferLen);
+
+	/**
+	 * @brief Parses the data, calling the handler for each event
+	 *
+	 * @param handler The handler to call. Events are generated in the order they appear in the data,
+	 * so if the data is not valid some events may be generated before parse returns false.
+	 *
+	 * @return true if the data is a complete JSON value and the handler did not stop parsing
+	 */
+	bool parse(JsonSaxHandler &handler);
+
+	/**
+	 * @brief Maximum nesting depth of objects and arrays
+	 */
+	static const size_t MAX_DEPTH = 32;
+
+	/**
+	 * @brief Returns true if str is a valid JSON number: an optional minus sign, an integer part with
+	 * no leading zeros, and an optional fraction and exponent, each with at least one digit
+	 */
+	static bool isNumber(const char *str, size_t len);
+};
+
+/**
+ * @brief Creates a JsonSaxParser with a static buffer.
+ *
+ * @param BUFFER_SIZE The maximum size of the data to be parsed, in bytes.
+ */
+template <size_t BUFFER_SIZE>
+class JsonSaxParserStatic : public JsonSaxParser {
+public:
+	explicit JsonSaxParserStatic() : JsonSaxParser(staticBuffer, BUFFER_SIZE) {};
+
+private:
+	char staticBuffer[BUFFER_SIZE]; //!< static buffer to hold the data
+};
+
 
 
 #endif /* __JSONPARSERGENERATORRK_H */
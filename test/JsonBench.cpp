@@ -0,0 +1,116 @@
+#include "Particle.h"
+#include "JsonParserGeneratorRK.h"
+
+#include <chrono>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif
+
+// Benchmarks for the JSON generator. Build and run with make bench.
+
+static const size_t NUM_VALUES = 100000;
+static const int NUM_PASSES = 10;
+
+static uint64_t readCycles() {
+#ifdef HAS_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint64_t readNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs fn(index, writer) for every value, NUM_PASSES times, and prints the time and bytes per value
+template<class Fn>
+void runBenchmark(const char *name, Fn fn) {
+	JsonWriterStatic<256> jw;
+	size_t totalBytes = 0;
+
+	uint64_t startNs = readNanoseconds();
+	uint64_t startCycles = readCycles();
+
+	for(int pass = 0; pass < NUM_PASSES; pass++) {
+		for(size_t ii = 0; ii < NUM_VALUES; ii++) {
+			jw.init();
+			fn(ii, jw);
+			totalBytes += jw.getOffset();
+		}
+	}
+
+	uint64_t cycles = readCycles() - startCycles;
+	uint64_t ns = readNanoseconds() - startNs;
+	double count = (double)NUM_VALUES * NUM_PASSES;
+
+	printf("%-40s %8.1f ns/value %8.1f cycles/value %6.2f bytes/value\n", name, ns / count, cycles / count, totalBytes / count);
+}
+
+int main(int argc, char *argv[]) {
+	// Typical sensor readings: a few significant digits
+	double *readings = new double[NUM_VALUES];
+	// Random bit patterns: full 17-digit values over the whole exponent range
+	double *randomDoubles = new double[NUM_VALUES];
+
+	srand(1);
+	for(size_t ii = 0; ii < NUM_VALUES; ii++) {
+		readings[ii] = (rand() % 200000 - 100000) / 100.0;
+
+		do {
+			uint64_t bits = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+			memcpy(&randomDoubles[ii], &bits, sizeof(double));
+		} while(isnan(randomDoubles[ii]) || isinf(randomDoubles[ii]));
+	}
+
+	printf("double formatting, sensor readings (e.g. -123.45)\n");
+	runBenchmark("insertValue(double)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertValue(readings[ii]);
+	});
+	runBenchmark("insertValue(double), setFloatPlaces(2)", [&](size_t ii, JsonWriter &jw) {
+		jw.setFloatPlaces(2);
+		jw.insertValue(readings[ii]);
+	});
+	runBenchmark("insertValue((float))", [&](size_t ii, JsonWriter &jw) {
+		jw.insertValue((float)readings[ii]);
+	});
+	runBenchmark("insertsprintf(\"%lf\") (old default)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertsprintf("%lf", readings[ii]);
+	});
+	runBenchmark("insertsprintf(\"%.17g\")", [&](size_t ii, JsonWriter &jw) {
+		jw.insertsprintf("%.17g", readings[ii]);
+	});
+
+	printf("\ndouble formatting, random bit patterns\n");
+	runBenchmark("insertValue(double)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertValue(randomDoubles[ii]);
+	});
+	runBenchmark("insertsprintf(\"%.17g\")", [&](size_t ii, JsonWriter &jw) {
+		jw.insertsprintf("%.17g", randomDoubles[ii]);
+	});
+
+	printf("\ninteger formatting, 0 to 99999\n");
+	runBenchmark("insertValue(int)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertValue((int)ii);
+	});
+	runBenchmark("insertsprintf(\"%d\") (old)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertsprintf("%d", (int)ii);
+	});
+	runBenchmark("insertValue(int64_t)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertValue((int64_t)ii * 1000000007LL);
+	});
+
+	printf("\nstring escaping, 80 character log message\n");
+	const char *logMessage = "sensor 3 reading out of range: \"temp\"=125.4 (limit 100.0)\tretry 2 of 5, will reset";
+	runBenchmark("insertValue(const char *)", [&](size_t ii, JsonWriter &jw) {
+		jw.insertValue(logMessage);
+	});
+
+	delete[] readings;
+	delete[] randomDoubles;
+
+	return 0;
+}
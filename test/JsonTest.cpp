@@ -1,6 +1,9 @@
 #include "Particle.h"
 #include "JsonParserGeneratorRK.h"
 
+#include <limits.h>
+#include <math.h>
+
 void printTokens(JsonParser &jp);
 void printToken(JsonParser &jp, const JsonParserGeneratorRK::jsmntok_t *tok);
 void printJson(JsonParser &jp);
@@ -83,6 +86,67 @@ void _assertJsonWriterBuffer(JsonWriter &jw, const char *expected, size_t line)
 }
 #define assertJsonWriterBuffer(jw, expected) _assertJsonWriterBuffer(jw, expected, __LINE__)
 
+// Records the JsonSaxParser events as text
+class SaxRecorder : public JsonSaxHandler {
+public:
+	SaxRecorder() : len(0), stopAfter(-1) { events[0] = 0; };
+
+	bool startObject() { return add("{", 0, 0); };
+	bool endObject() { return add("}", 0, 0); };
+	bool startArray() { return add("[", 0, 0); };
+	bool endArray() { return add("]", 0, 0); };
+	bool key(const char *str, size_t strLen) { return add("k:", str, strLen); };
+	bool string(const char *str, size_t strLen) { return add("s:", str, strLen); };
+	bool number(const char *str, size_t strLen) { return add("n:", str, strLen); };
+	bool boolean(bool value) { return add(value ? "true" : "false", 0, 0); };
+	bool null() { return add("null", 0, 0); };
+
+	bool add(const char *type, const char *str, size_t strLen) {
+		len += snprintf(&events[len], sizeof(events) - len, "%s%.*s ", type, (int)strLen, str ? str : "");
+		return --stopAfter != 0;
+	}
+
+	char events[512];
+	size_t len;
+	int stopAfter;
+};
+
+// Records the output of a JsonSinkWriter
+class PrintRecorder : public Print {
+public:
+	PrintRecorder() : len(0), numWrites(0) {};
+
+	size_t write(uint8_t c) { return write(&c, 1); };
+	size_t write(const uint8_t *buf, size_t bufLen) {
+		assert(len + bufLen <= sizeof(output));
+		memcpy(&output[len], buf, bufLen);
+		len += bufLen;
+		numWrites++;
+		return bufLen;
+	}
+
+	char output[1024];
+	size_t len;
+	size_t numWrites;
+};
+
+// Writes a document that uses all of the insert methods, for comparing writers
+void writeSinkTestDocument(JsonWriter &jw) {
+	jw.startObject();
+	jw.insertKeyValue("a", 1234);
+	jw.insertKeyValue("long", "a string that is longer than the staging buffer\twith \"escapes\" and \xc2\xa2");
+	jw.insertKeyValue("d", 12.5);
+	jw.insertKeyValue("i64", (int64_t)-1234567890123LL);
+	jw.insertKeyArray("arr");
+	for(int ii = 0; ii < 20; ii++) {
+		jw.insertArrayValue(ii * 1000);
+	}
+	jw.finishObjectOrArray();
+	jw.insertCheckSeparator();
+	jw.insertsprintf("\"fmt\":%d", 5678);
+	jw.finishObjectOrArray();
+}
+
 // assert(jw.getOffset() == 14 && strncmp(jw.getBuffer(), "\\b\\f\\n\\r\\t\\\"\\", 8) == 0);
 
 int main(int argc, char *argv[]) {
@@ -394,6 +458,623 @@ int main(int argc, char *argv[]) {
 		assert(!jp.parse());
 	}
 
+	// Dynamic tokens grow while parsing and are kept across clear()
+	{
+		JsonParser jp;
+
+		char *data = readTestData("test2d.json");
+		jp.addString(data);
+
+		assert(jp.parse());
+		size_t maxTokens = jp.getMaxTokens();
+		assert(maxTokens >= (size_t)(jp.getTokensEnd() - jp.getTokens()));
+
+		int intValue;
+		assert(jp.getReference().key("city").key("id").valueInt() == 524901);
+		assert(jp.getValueByKey(jp.getOuterObject(), "cnt", intValue));
+		assert(intValue == 40);
+
+		JsonParserGeneratorRK::jsmntok_t *tokens = jp.getTokens();
+
+		jp.clear();
+		jp.addString(data);
+		free(data);
+
+		assert(jp.parse());
+		assert(jp.getMaxTokens() == maxTokens);
+		assert(jp.getTokens() == tokens);
+		assert(jp.getReference().key("city").key("id").valueInt() == 524901);
+
+		// Starting from a token array that's too small
+		JsonParser jp2;
+		assert(jp2.allocateTokens(2));
+		jp2.addString("{\"a\":[1,2,3,{\"b\":[4,5,6]}],\"c\":\"d\"}");
+		assert(jp2.parse());
+		assert(jp2.getTokensEnd() - jp2.getTokens() == 14);
+		assert(jp2.getReference().key("a").index(3).key("b").index(2).valueInt() == 6);
+		assert(jp2.getReference().key("c").valueString() == "d");
+
+		// Whitespace only is not valid JSON
+		jp2.clear();
+		jp2.addString("  ");
+		assert(!jp2.parse());
+	}
+
+	// Subtree extents stored by the tokenizer
+	{
+		JsonParserStatic<256, 32> jp;
+
+		jp.addString("{\"a\":[1,[2,3],{\"b\":4}],\"c\":{},\"d\":\"e\"}");
+		assert(jp.parse());
+
+		const JsonParserGeneratorRK::jsmntok_t *tokens = jp.getTokens();
+		assert(tokens[0].extent == 14);	// outer object
+		assert(tokens[1].extent == 1);	// "a"
+		assert(tokens[2].extent == 8);	// [1,[2,3],{"b":4}]
+		assert(tokens[4].extent == 3);	// [2,3]
+		assert(tokens[7].extent == 3);	// {"b":4}
+		assert(tokens[11].extent == 1);	// {}
+
+		const JsonParserGeneratorRK::jsmntok_t *value;
+		assert(jp.getValueTokenByKey(jp.getOuterObject(), "a", value));
+		assert(jp.getArraySize(value) == 3);
+		assert(jp.getReference().key("a").index(2).key("b").valueInt() == 4);
+		assert(jp.getReference().key("c").size() == 0);
+		assert(jp.getReference().key("d").valueString() == "e");
+		assert(jp.getTokenByIndex(value, 3) == NULL);
+	}
+
+	// Key lookup, including keys with escapes
+	{
+		JsonParserStatic<256, 32> jp;
+
+		jp.addString("{\"ab\":1,\"abc\":2,\"a\\\"b\":3,\"\\u00A2x\":4,\"x\\ny\":{\"z\":5},\"last\":6}");
+		assert(jp.parse());
+
+		assert(jp.getReference().key("ab").valueInt() == 1);
+		assert(jp.getReference().key("abc").valueInt() == 2);
+		assert(jp.getReference().key("a\"b").valueInt() == 3);
+		assert(jp.getReference().key("\xc2\xa2x").valueInt() == 4);
+		assert(jp.getReference().key("x\ny").key("z").valueInt() == 5);
+		assert(jp.getReference().key("last").valueInt() == 6);
+
+		const JsonParserGeneratorRK::jsmntok_t *value;
+		assert(!jp.getValueTokenByKey(jp.getOuterObject(), "a", value));
+		assert(!jp.getValueTokenByKey(jp.getOuterObject(), "abcd", value));
+		assert(!jp.getValueTokenByKey(jp.getOuterObject(), "a\"", value));
+		assert(!jp.getValueTokenByKey(jp.getOuterObject(), "\xc2\xa2", value));
+		assert(!jp.getValueTokenByKey(jp.getOuterObject(), "z", value));
+	}
+
+	// Key index
+	{
+		JsonParserStatic<1024, 100> jp;
+		int32_t keyIndex[80];
+
+		jp.setKeyIndexBuffer(keyIndex, sizeof(keyIndex) / sizeof(keyIndex[0]));
+
+		JsonWriterStatic<1024> jw;
+		jw.startObject();
+		for(int ii = 0; ii < 20; ii++) {
+			char key[16];
+			snprintf(key, sizeof(key), "key%d", ii);
+			jw.insertKeyValue(key, ii);
+		}
+		jw.insertKeyValue("a\\b", 100);
+		jw.insertKeyValue("key5", 101); // duplicate, first one wins
+		jw.insertKeyObject("inner");
+		for(int ii = 0; ii < 10; ii++) {
+			char key[16];
+			snprintf(key, sizeof(key), "inner%d", ii);
+			jw.insertKeyValue(key, ii + 200);
+		}
+		jw.finishObjectOrArray();
+		jw.finishObjectOrArray();
+
+		jp.addData(jw.getBuffer(), jw.getOffset());
+		assert(jp.parse());
+
+		for(int pass = 0; pass < 2; pass++) {
+			for(int ii = 0; ii < 20; ii++) {
+				char key[16];
+				snprintf(key, sizeof(key), "key%d", ii);
+				assert(jp.getReference().key(key).valueInt(-1) == ii);
+			}
+			assert(jp.getReference().key("a\\b").valueInt() == 100);
+			assert(jp.getReference().key("missing").valueInt(-1) == -1);
+
+			// The inner object index does not fit in the remaining space, so this is a linear search
+			assert(jp.getReference().key("inner").key("inner9").valueInt() == 209);
+			assert(jp.getReference().key("inner").key("inner10").valueInt(-1) == -1);
+		}
+		// Outer object: 23 keys in 64 slots
+		assert(keyIndex[0] == 0);
+		assert(keyIndex[1] == 64);
+
+		// Parsing again discards the indexes
+		jp.clear();
+		jp.addString("{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8}");
+		assert(jp.parse());
+		assert(jp.getReference().key("k8").valueInt() == 8);
+		assert(jp.getReference().key("key8").valueInt(-1) == -1);
+
+		// Last key without a value, at the end of the tokens and inside an array
+		const JsonParserGeneratorRK::jsmntok_t *value;
+		jp.clear();
+		jp.addString("{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\"}");
+		assert(jp.parse());
+		assert(jp.getReference().key("k7").valueInt() == 7);
+		assert(!jp.getValueTokenByKey(jp.getOuterObject(), "k8", value));
+
+		jp.clear();
+		jp.addString("[{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\"},9]");
+		assert(jp.parse());
+		assert(jp.getReference().index(0).key("k7").valueInt() == 7);
+		assert(jp.getReference().index(0).key("k8").valueInt(-1) == -1);
+	}
+
+	// String scanning, with the escape or end quote at every offset in and around the SIMD blocks
+	{
+		JsonParserStatic<256, 10> jp;
+
+		for(size_t strLen = 0; strLen < 70; strLen++) {
+			for(size_t escapeAt = 0; escapeAt <= strLen; escapeAt++) {
+				char s[128];
+				size_t sLen = 0;
+				s[sLen++] = '[';
+				s[sLen++] = '"';
+				for(size_t ii = 0; ii < strLen; ii++) {
+					if (ii == escapeAt) {
+						s[sLen++] = '\\';
+						s[sLen++] = '"';
+					}
+					else {
+						s[sLen++] = (char)('a' + (ii % 26));
+					}
+				}
+				strcpy(&s[sLen], "\",1]");
+				sLen += 4;
+
+				jp.clear();
+				jp.addData(s, sLen);
+				assert(jp.parse());
+				assert(jp.getTokens()[1].type == JsonParserGeneratorRK::JSMN_STRING);
+				assert(jp.getTokens()[1].start == 2);
+				assert(jp.getTokens()[1].end == (int)(sLen - 4));
+
+				String value;
+				assert(jp.getValueByIndex(jp.getOuterArray(), 0, value));
+				assert(value.length() == strLen);
+				assert(jp.getReference().index(1).valueInt() == 1);
+
+				// Unterminated string
+				jp.clear();
+				jp.addData(s, sLen - 4);
+				assert(!jp.parse());
+			}
+		}
+	}
+
+	// Incremental parsing
+	{
+		const char *doc = "{\"a\":12345,\"b\":[true,false,null,-1.5e3],\"c\":{\"d\":\"e\\\"f\"},\"g\":678}";
+		size_t docLen = strlen(doc);
+
+		JsonParserStatic<256, 30> full;
+		full.addString(doc);
+		assert(full.parse());
+
+		// One byte at a time, so every primitive and string is split
+		JsonParserStatic<256, 30> jp;
+		for(size_t ii = 0; ii < docLen; ii++) {
+			jp.addData(&doc[ii], 1);
+			assert(jp.parseIncremental() == (ii == docLen - 1));
+		}
+		assert(jp.getTokensEnd() - jp.getTokens() == full.getTokensEnd() - full.getTokens());
+		for(int ii = 0; ii < full.getTokensEnd() - full.getTokens(); ii++) {
+			assert(jp.getTokens()[ii].type == full.getTokens()[ii].type);
+			assert(jp.getTokens()[ii].start == full.getTokens()[ii].start);
+			assert(jp.getTokens()[ii].end == full.getTokens()[ii].end);
+			assert(jp.getTokens()[ii].size == full.getTokens()[ii].size);
+			assert(jp.getTokens()[ii].extent == full.getTokens()[ii].extent);
+		}
+		assert(jp.getReference().key("a").valueInt() == 12345);
+		assert(jp.getReference().key("g").valueInt() == 678);
+
+		// Chunks out of order, with dynamic buffers
+		JsonParser jp2;
+		const size_t chunkSize = 8;
+		size_t numChunks = (docLen + chunkSize - 1) / chunkSize;
+		const size_t order[] = { 1, 0, 3, 4, 2, 6, 7, 8, 5 };
+		assert(numChunks == sizeof(order) / sizeof(order[0]));
+		for(size_t ii = 0; ii < numChunks; ii++) {
+			char event[32], chunk[chunkSize + 1];
+			snprintf(event, sizeof(event), "hook-response/test/%u", (unsigned) order[ii]);
+			size_t len = docLen - order[ii] * chunkSize;
+			if (len > chunkSize) {
+				len = chunkSize;
+			}
+			memcpy(chunk, &doc[order[ii] * chunkSize], len);
+			chunk[len] = 0;
+
+			assert(jp2.addChunkedData(event, chunk, chunkSize));
+			assert(jp2.parseIncremental() == (ii == numChunks - 1));
+		}
+		assert(jp2.getReference().key("b").index(3).valueFloat() == -1500.0);
+		assert(jp2.getReference().key("c").key("d").valueString() == "e\"f");
+
+		// clear() starts over
+		jp2.clear();
+		jp2.addString("[1,2");
+		assert(!jp2.parseIncremental());
+		jp2.addString("3]");
+		assert(jp2.parseIncremental());
+		assert(jp2.getReference().size() == 2);
+		assert(jp2.getReference().index(1).valueInt() == 23);
+
+		// Errors stay errors
+		jp2.clear();
+		jp2.addString("[1,}");
+		assert(!jp2.parseIncremental());
+		jp2.addString("]");
+		assert(!jp2.parseIncremental());
+	}
+
+	// Number parsing
+	{
+		JsonParserStatic<256, 10> jp;
+		int intValue;
+		unsigned long ulongValue;
+
+		const char *ints[] = { "0", "-0", "2147483647", "-2147483648", "12.5", "+7", "1e5" };
+		const int intResults[] = { 0, 0, 2147483647, (-2147483647 - 1), 12, 7, 1 };
+		for(size_t ii = 0; ii < sizeof(ints) / sizeof(ints[0]); ii++) {
+			jp.clear();
+			jp.addString(ints[ii]);
+			assert(jp.parse());
+			assert(jp.getTokenValue(jp.getTokens(), intValue));
+			assert(intValue == intResults[ii]);
+		}
+
+		const char *badInts[] = { "2147483648", "-2147483649", "99999999999999999999", "abc", "-", "\"\"" };
+		for(size_t ii = 0; ii < sizeof(badInts) / sizeof(badInts[0]); ii++) {
+			jp.clear();
+			jp.addString(badInts[ii]);
+			assert(jp.parse());
+			assert(!jp.getTokenValue(jp.getTokens(), intValue));
+		}
+
+		jp.clear();
+		jp.addString("[4294967295,-1,\"123\"]");
+		assert(jp.parse());
+		assert(jp.getValueByIndex(jp.getOuterArray(), 0, ulongValue) && ulongValue == 4294967295UL);
+		assert(!jp.getValueByIndex(jp.getOuterArray(), 1, ulongValue));
+		assert(jp.getValueByIndex(jp.getOuterArray(), 2, ulongValue) && ulongValue == 123);
+
+		// Floating point values must match strtod and strtof exactly, including those that are
+		// longer than the fast path handles
+		const char *floats[] = { "0", "-0.0", "0.1", "1.5", "-1500.25", "3.14159265358979323846", "1e23",
+				"9007199254740993", "1.7976931348623157e308", "4.9e-324", "2.2250738585072011e-308",
+				"123456789012345678901234567890", "0.000000000000000000000000000001234", "12e30", "7.038531e-26",
+				"1e-400", "16777217", "3.4028235e38", "1.17549435e-38" };
+		for(size_t ii = 0; ii < sizeof(floats) / sizeof(floats[0]); ii++) {
+			for(int inArray = 0; inArray < 2; inArray++) {
+				jp.clear();
+				if (inArray) {
+					jp.addString("[");
+				}
+				jp.addString(floats[ii]);
+				if (inArray) {
+					jp.addString("]");
+				}
+				assert(jp.parse());
+				const JsonParserGeneratorRK::jsmntok_t *token = &jp.getTokens()[inArray];
+
+				double doubleValue, doubleExpected = strtod(floats[ii], 0);
+				assert(jp.getTokenValue(token, doubleValue));
+				assert(memcmp(&doubleValue, &doubleExpected, sizeof(double)) == 0);
+
+				float floatValue, floatExpected = strtof(floats[ii], 0);
+				if (isinf(floatExpected)) {
+					// Too large for a float
+					assert(!jp.getTokenValue(token, floatValue));
+				}
+				else {
+					assert(jp.getTokenValue(token, floatValue));
+					assert(memcmp(&floatValue, &floatExpected, sizeof(float)) == 0);
+				}
+			}
+		}
+
+		// Out of range values fail instead of returning infinity
+		const char *tooLarge[] = { "1e400", "-1e400", "1.8e308", "123456789012345678901234567890e300" };
+		for(size_t ii = 0; ii < sizeof(tooLarge) / sizeof(tooLarge[0]); ii++) {
+			jp.clear();
+			jp.addString(tooLarge[ii]);
+			assert(jp.parse());
+			double doubleValue;
+			float floatValue;
+			assert(!jp.getTokenValue(jp.getTokens(), doubleValue));
+			assert(!jp.getTokenValue(jp.getTokens(), floatValue));
+		}
+		const char *tooLargeForFloat[] = { "1e39", "-1e39", "3.5e38", "340282356779733661637539395458142568448" };
+		for(size_t ii = 0; ii < sizeof(tooLargeForFloat) / sizeof(tooLargeForFloat[0]); ii++) {
+			jp.clear();
+			jp.addString(tooLargeForFloat[ii]);
+			assert(jp.parse());
+			double doubleValue;
+			float floatValue;
+			assert(jp.getTokenValue(jp.getTokens(), doubleValue) && doubleValue == strtod(tooLargeForFloat[ii], 0));
+			assert(!jp.getTokenValue(jp.getTokens(), floatValue));
+		}
+
+		jp.clear();
+		jp.addString("[\"x\",\"2.5\"]");
+		assert(jp.parse());
+		double doubleValue;
+		assert(!jp.getValueByIndex(jp.getOuterArray(), 0, doubleValue));
+		assert(jp.getValueByIndex(jp.getOuterArray(), 1, doubleValue) && doubleValue == 2.5);
+	}
+
+	// Nesting depth limit
+	{
+		JsonParser jp;
+		for(int ii = 0; ii < JSMN_MAX_DEPTH; ii++) {
+			jp.addString((ii % 2) ? "{\"a\":" : "[");
+		}
+		jp.addString("1");
+		for(int ii = JSMN_MAX_DEPTH - 1; ii >= 0; ii--) {
+			jp.addString((ii % 2) ? "}" : "]");
+		}
+		assert(jp.parse());
+		assert(jp.getTokens()[0].extent == jp.getTokensEnd() - jp.getTokens());
+
+		JsonParserGeneratorRK::jsmn_parser parser;
+		JsonParserGeneratorRK::jsmntok_t tokens[100];
+		jp.clear();
+		for(int ii = 0; ii <= JSMN_MAX_DEPTH; ii++) {
+			jp.addString("[");
+		}
+		JsonParserGeneratorRK::jsmn_init(&parser);
+		assert(JsonParserGeneratorRK::jsmn_parse(&parser, jp.getBuffer(), jp.getOffset(), tokens, 100) == JsonParserGeneratorRK::JSMN_ERROR_DEPTH);
+		assert(!jp.parse());
+
+		// Wide array of objects and primitives
+		jp.clear();
+		jp.addString("[");
+		for(int ii = 0; ii < 1000; ii++) {
+			char buf[32];
+			snprintf(buf, sizeof(buf), "%s{\"a\":%d},%d", (ii ? "," : ""), ii, ii);
+			jp.addString(buf);
+		}
+		jp.addString("]");
+		assert(jp.parse());
+		assert(jp.getReference().size() == 2000);
+		assert(jp.getReference().index(1998).key("a").valueInt() == 999);
+		assert(jp.getReference().index(1999).valueInt() == 999);
+
+		// Mismatched close
+		jp.clear();
+		jp.addString("{\"a\":[1}");
+		assert(!jp.parse());
+	}
+
+#ifdef JSMN_COMPACT_TOKENS
+	// Compact tokens
+	{
+#ifdef JSMN_PARENT_LINKS
+		assert(sizeof(JsonParserGeneratorRK::jsmntok_t) == 12);
+#else
+		assert(sizeof(JsonParserGeneratorRK::jsmntok_t) == 8);
+#endif
+
+		// Too large for 16-bit offsets
+		JsonParser jp;
+		jp.addString("[\"");
+		while(jp.getOffset() < 70000) {
+			jp.addString("0123456789");
+		}
+		jp.addString("\"]");
+		assert(!jp.parse());
+
+		// Array too large for the size field
+		jp.clear();
+		jp.addString("[0");
+		for(int ii = 1; ii < JsonParserGeneratorRK::JSMN_SIZE_MAX; ii++) {
+			jp.addString(",0");
+		}
+		jp.addString("]");
+		assert(jp.parse());
+		assert(jp.getReference().size() == (size_t)JsonParserGeneratorRK::JSMN_SIZE_MAX);
+
+		jp.clear();
+		jp.addString("[0");
+		for(int ii = 1; ii <= JsonParserGeneratorRK::JSMN_SIZE_MAX; ii++) {
+			jp.addString(",0");
+		}
+		jp.addString("]");
+		assert(!jp.parse());
+	}
+#endif
+
+	// SAX parser
+	{
+		JsonSaxParserStatic<256> sp;
+		sp.addString("{\"a\":[1,-2.5e3,true,false,null,\"x\\\"y\"],\"b\":{},\"c\":[],\"d\":{\"e\":\"\"}}");
+
+		SaxRecorder rec;
+		assert(sp.parse(rec));
+		assert(strcmp(rec.events, "{ k:a [ n:1 n:-2.5e3 true false null s:x\\\"y ] k:b { } k:c [ ] k:d { k:e s: } } ") == 0);
+
+		// Handler stops parsing
+		SaxRecorder rec2;
+		rec2.stopAfter = 3;
+		assert(!sp.parse(rec2));
+		assert(strcmp(rec2.events, "{ k:a [ ") == 0);
+
+		// Top-level primitive
+		sp.clear();
+		sp.addString(" 123 ");
+		SaxRecorder rec3;
+		assert(sp.parse(rec3));
+		assert(strcmp(rec3.events, "n:123 ") == 0);
+
+		// Valid numbers
+		const char *numbers[] = { "0", "-0", "10", "-1.5", "0.25", "1e5", "1E+5", "2.5e-10", "-0.0e0" };
+		for(size_t ii = 0; ii < sizeof(numbers) / sizeof(numbers[0]); ii++) {
+			assert(JsonSaxParser::isNumber(numbers[ii], strlen(numbers[ii])));
+		}
+
+		// Invalid or incomplete data
+		const char *bad[] = { "", "{", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "[1,]", "[1 2]", "{1:2}", "[1}", "{\"a\":1]",
+				"[\"abc]", "[\"\\x\"]", "[\"\\u12\"]", "[\"\\u12\xe9\xa0\"]", "[tru]", "[abc]", "[1]]", "[1] 2", "[1]x", "{\"a\"::1}",
+				"[-]", "[1-2e]", "[1.]", "[.5]", "[1e]", "[1e+]", "[01]", "[-01]", "[1.2.3]", "[1e5e5]", "[+1]", "[0x10]" };
+		for(size_t ii = 0; ii < sizeof(bad) / sizeof(bad[0]); ii++) {
+			sp.clear();
+			sp.addString(bad[ii]);
+			SaxRecorder rec4;
+			assert(!sp.parse(rec4));
+		}
+
+		// Nesting depth limit, with a dynamic buffer
+		JsonSaxParser sp2;
+		for(size_t ii = 0; ii < JsonSaxParser::MAX_DEPTH; ii++) {
+			sp2.addString("[");
+		}
+		for(size_t ii = 0; ii < JsonSaxParser::MAX_DEPTH; ii++) {
+			sp2.addString("]");
+		}
+		JsonSaxHandler ignore;
+		assert(sp2.parse(ignore));
+		sp2.clear();
+		for(size_t ii = 0; ii <= JsonSaxParser::MAX_DEPTH; ii++) {
+			sp2.addString("[");
+		}
+		for(size_t ii = 0; ii <= JsonSaxParser::MAX_DEPTH; ii++) {
+			sp2.addString("]");
+		}
+		assert(!sp2.parse(ignore));
+	}
+
+	// Unescaping runs into String and buffers
+	{
+		JsonParserStatic<512, 10> jp;
+		jp.addString("[\"0123456789012345678901234567890123456789\\n0123456789\\u00a2\\u20ACx\\\"\",\"a\\u0000b\",\"\\/\\\\\"]");
+		assert(jp.parse());
+
+		const char *expected = "0123456789012345678901234567890123456789\n0123456789\xc2\xa2\xe2\x82\xacx\"";
+
+		String s;
+		assert(jp.getValueByIndex(jp.getOuterArray(), 0, s));
+		assert(s == expected);
+
+		// The buffer does not need to be zeroed first
+		char buf[64];
+		memset(buf, 'x', sizeof(buf));
+		size_t bufLen = sizeof(buf);
+		assert(jp.getTokenValue(jp.getTokens() + 1, buf, bufLen));
+		assert(strcmp(buf, expected) == 0);
+		assert(bufLen == strlen(expected) + 1);
+
+		// Truncated, but the length returned is the full length
+		char smallBuf[10];
+		memset(smallBuf, 'x', sizeof(smallBuf));
+		bufLen = sizeof(smallBuf);
+		assert(jp.getTokenValue(jp.getTokens() + 1, smallBuf, bufLen));
+		assert(strcmp(smallBuf, "012345678") == 0);
+		assert(bufLen == strlen(expected) + 1);
+
+		// Embedded null
+		assert(jp.getValueByIndex(jp.getOuterArray(), 1, s));
+		assert(s.length() == 3 && s.c_str()[0] == 'a' && s.c_str()[1] == 0 && s.c_str()[2] == 'b');
+
+		assert(jp.getValueByIndex(jp.getOuterArray(), 2, s));
+		assert(s == "/\\");
+	}
+
+	// Zero-copy views of strings without escapes
+	{
+		JsonParserStatic<256, 20> jp;
+		jp.addString("{\"plain\":\"abc\",\"esc\\u0061ped\":\"a\\tb\",\"num\":123,\"empty\":\"\",\"list\":[\"x\",\"y\\\\\"]}");
+		assert(jp.parse());
+
+		const JsonParserGeneratorRK::jsmntok_t *keyToken, *valueToken;
+		assert(jp.getKeyValueTokenByIndex(jp.getOuterObject(), keyToken, valueToken, 0));
+		assert(!keyToken->escaped && !valueToken->escaped);
+
+		const char *str;
+		size_t strLen;
+		assert(jp.getTokenView(valueToken, str, strLen));
+		assert(strLen == 3 && memcmp(str, "abc", 3) == 0);
+		assert(str == jp.getBuffer() + valueToken->start);
+
+		// Escaped key and value are flagged, and the key is still found by its decoded name
+		assert(jp.getKeyValueTokenByIndex(jp.getOuterObject(), keyToken, valueToken, 1));
+		assert(keyToken->escaped && valueToken->escaped);
+		assert(!jp.getTokenView(valueToken, str, strLen));
+		assert(strLen == 4 && memcmp(str, "a\\tb", 4) == 0);
+		assert(jp.getReference().key("escaped").valueString() == "a\tb");
+
+		assert(jp.getReference().key("plain").valueView(str, strLen));
+		assert(strLen == 3 && memcmp(str, "abc", 3) == 0);
+		assert(jp.getReference().key("num").valueView(str, strLen));
+		assert(strLen == 3 && memcmp(str, "123", 3) == 0);
+		assert(jp.getReference().key("empty").valueView(str, strLen));
+		assert(strLen == 0);
+		assert(!jp.getReference().key("escaped").valueView(str, strLen));
+		assert(!jp.getReference().key("missing").valueView(str, strLen));
+
+		assert(jp.getReference().key("list").index(0).valueView(str, strLen));
+		assert(strLen == 1 && str[0] == 'x');
+		assert(!jp.getReference().key("list").index(1).valueView(str, strLen));
+		assert(jp.getReference().key("list").index(1).valueString() == "y\\");
+
+		// The flag is recomputed when a token is reused after a failed parse
+		jp.clear();
+		jp.addString("[\"a\\nb\"]");
+		assert(jp.parse());
+		assert(jp.getTokens()[1].escaped);
+		jp.clear();
+		jp.addString("[\"ab\"]");
+		assert(jp.parse());
+		assert(!jp.getTokens()[1].escaped);
+	}
+
+	// In-situ parsing
+	{
+		JsonParserStatic<256, 20> jp;
+		jp.addString("{\"a\":\"plain\",\"b\\u0062\":\"x\\ty\\u00a2\\\"z\",\"n\":-12.5,\"t\":true,\"list\":[\"\\\\\",\"\",7]}");
+		assert(jp.parse());
+		assert(!jp.getTokenCString(jp.getTokens() + 2));
+		assert(jp.parseInSitu());
+
+		assert(strcmp(jp.getReference().key("a").valueCString(), "plain") == 0);
+		assert(strcmp(jp.getReference().key("bb").valueCString(), "x\ty\xc2\xa2\"z") == 0);
+		assert(strcmp(jp.getReference().key("n").valueCString(), "-12.5") == 0);
+		assert(strcmp(jp.getReference().key("t").valueCString(), "true") == 0);
+		assert(strcmp(jp.getReference().key("list").index(0).valueCString(), "\\") == 0);
+		assert(strcmp(jp.getReference().key("list").index(1).valueCString(), "") == 0);
+		assert(strcmp(jp.getReference().key("list").index(2).valueCString(), "7") == 0);
+		assert(jp.getReference().key("missing").valueCString(NULL) == NULL);
+
+		// Decoded tokens are views and the other accessors still work
+		const char *str;
+		size_t strLen;
+		assert(jp.getReference().key("bb").valueView(str, strLen));
+		assert(strLen == 7 && memcmp(str, "x\ty\xc2\xa2\"z", 7) == 0);
+		assert(jp.getReference().key("bb").valueString() == "x\ty\xc2\xa2\"z");
+		assert(jp.getReference().key("n").valueDouble() == -12.5);
+		assert(jp.getReference().key("t").valueBool());
+		assert(jp.getReference().key("list").size() == 3);
+		assert(jp.getReference().key("list").index(2).valueInt() == 7);
+
+		// A top-level primitive at the end of the data is terminated too
+		JsonParserStatic<16, 2> jp2;
+		jp2.addString("1234");
+		assert(jp2.parseInSitu());
+		assert(strcmp(jp2.getTokenCString(jp2.getTokens()), "1234") == 0);
+	}
+
 	// Unicode and some other odd data tests
 	{
 		JsonParser jp;
@@ -422,6 +1103,8 @@ int main(int argc, char *argv[]) {
 		assert(uc[ii++] == 0xc2);
 		assert(uc[ii++] == 0xa2);
 
+		assert(sc[ii++] == 'c');
+
 		assert(uc[ii++] == 0xe2);
 		assert(uc[ii++] == 0x82);
 		assert(uc[ii++] == 0xac);
@@ -1043,12 +1726,15 @@ int main(int argc, char *argv[]) {
 		const size_t ordering[12] = { 0, 1, 4, 5, 6, 7, 8, 9, 10, 11, 2, 3 };
 
 		for(size_t chunkIndex = 0; chunkIndex < 12; chunkIndex++) {
+			assert(!jp.isComplete());
+
 			bResult = getChunk(data, ordering[chunkIndex], eventPrefix);
 			assert(bResult);
 
 			bResult = jp.addChunkedData(eventName, chunkBuf);
 			assert(bResult);
 		}
+		assert(jp.isComplete());
 
 		bResult = jp.parse();
 		assert(bResult);
@@ -1079,6 +1765,131 @@ int main(int argc, char *argv[]) {
 		free(data);
 	}
 
+	// Chunk completeness tracking
+	{
+		JsonParserStatic<8192, 20> jp;
+		char *data = readTestData("test3e.json");
+		const char *eventPrefix = "hook-response/testEvent";
+
+		// The last (short) chunk first
+		assert(getChunk(data, 11, eventPrefix));
+		assert(jp.addChunkedData(eventName, chunkBuf));
+		assert(!jp.isComplete());
+
+		// A second short chunk, or a chunk after the last one, is rejected
+		assert(!jp.addChunkedData("hook-response/testEvent/3", "{}"));
+		assert(!jp.addChunkedData("hook-response/testEvent/12", "{}"));
+		assert(jp.getOffset() == strlen(data));
+
+		for(size_t chunkIndex = 0; chunkIndex < 11; chunkIndex++) {
+			assert(!jp.isComplete());
+			assert(getChunk(data, chunkIndex, eventPrefix));
+			assert(jp.addChunkedData(eventName, chunkBuf));
+		}
+		assert(jp.isComplete());
+		assert(jp.parse());
+		assert(strncmp(jp.getBuffer(), data, strlen(data)) == 0);
+
+		// A short chunk before one that was already received is rejected
+		jp.clear();
+		assert(!jp.isComplete());
+		assert(getChunk(data, 5, eventPrefix));
+		assert(jp.addChunkedData(eventName, chunkBuf));
+		assert(!jp.addChunkedData("hook-response/testEvent/2", "{}"));
+
+		// A response that is an exact multiple of the chunk size needs setChunkCount()
+		jp.clear();
+		assert(getChunk(data, 1, eventPrefix));
+		assert(jp.addChunkedData(eventName, chunkBuf));
+		assert(getChunk(data, 0, eventPrefix));
+		assert(jp.addChunkedData(eventName, chunkBuf));
+		assert(!jp.isComplete());
+		jp.setChunkCount(2);
+		assert(jp.isComplete());
+		assert(jp.getOffset() == 1024);
+
+		free(data);
+	}
+
+	// Reassembling interleaved chunked responses
+	{
+		JsonChunkReassemblerStatic<2, 8192, 100> reassembler;
+
+		char *data3e = readTestData("test3e.json");
+		char *data3d = readTestData("test3d.json");
+
+		size_t numCompleted = 0;
+		String completedNames[3];
+		size_t completedLengths[3];
+		reassembler.setCompletionCallback([&](const char *eventName, JsonParser &parser) {
+			completedNames[numCompleted] = eventName;
+			completedLengths[numCompleted] = parser.getOffset();
+			numCompleted++;
+		});
+
+		// test3e (12 chunks, out of order) and test3d (2 chunks) interleaved
+		const size_t ordering[12] = { 0, 1, 4, 5, 6, 7, 8, 9, 10, 11, 2, 3 };
+		for(size_t ii = 0; ii < 12; ii++) {
+			assert(getChunk(data3e, ordering[ii], "hook-response/eventA"));
+			assert(reassembler.addChunkedData(eventName, chunkBuf));
+
+			if (ii == 2 || ii == 5) {
+				assert(getChunk(data3d, (ii == 2) ? 1 : 0, "hook-response/eventB"));
+				assert(reassembler.addChunkedData(eventName, chunkBuf));
+			}
+			if (ii == 2) {
+				assert(reassembler.getNumInProgress() == 2);
+
+				// No parser available for a third response
+				assert(!reassembler.addChunkedData("hook-response/eventC/0", "{}"));
+			}
+		}
+
+		assert(numCompleted == 2);
+		assert(completedNames[0] == "hook-response/eventB");
+		assert(completedLengths[0] == strlen(data3d));
+		assert(completedNames[1] == "hook-response/eventA");
+		assert(completedLengths[1] == strlen(data3e));
+		assert(reassembler.getNumInProgress() == 0);
+
+		// Invalid JSON is discarded once all chunks have arrived
+		assert(!reassembler.addChunkedData("hook-response/eventC/0", "[1,2"));
+		assert(reassembler.getNumInProgress() == 0);
+		assert(numCompleted == 2);
+
+		// Responses that stop receiving chunks time out
+		reassembler.setTimeout(10);
+		assert(getChunk(data3e, 0, "hook-response/eventA"));
+		assert(reassembler.addChunkedData(eventName, chunkBuf));
+		assert(reassembler.getNumInProgress() == 1);
+		unsigned long start = millis();
+		while(millis() - start < 20) {
+		}
+		reassembler.loop();
+		assert(reassembler.getNumInProgress() == 0);
+
+		// Dynamically allocated parsers with a maximum size
+		JsonChunkReassembler heapReassembler(4, 1024);
+		heapReassembler.setCompletionCallback([&](const char *eventName, JsonParser &parser) {
+			completedNames[numCompleted] = eventName;
+			completedLengths[numCompleted] = parser.getOffset();
+			numCompleted++;
+		});
+		assert(getChunk(data3d, 1, "hook-response/eventB"));
+		assert(heapReassembler.addChunkedData(eventName, chunkBuf));
+		assert(getChunk(data3d, 0, "hook-response/eventB"));
+		assert(heapReassembler.addChunkedData(eventName, chunkBuf));
+		assert(numCompleted == 3);
+		assert(completedLengths[2] == strlen(data3d));
+
+		assert(getChunk(data3e, 2, "hook-response/eventA"));
+		assert(!heapReassembler.addChunkedData(eventName, chunkBuf));
+		assert(heapReassembler.getNumInProgress() == 0);
+
+		free(data3e);
+		free(data3d);
+	}
+
 	// Chunked multi part (6023 bytes) - 12 chunks, dynamic allocation
 	{
 		JsonParser jp;
@@ -1105,7 +1916,61 @@ int main(int argc, char *argv[]) {
 		assert(strncmp(jp.getBuffer(), data, strlen(data)) == 0);
 
 		free(data);
-	}	
+	}
+
+	// Dynamic buffer growth, reserve, shrinkToFit, and maximum size
+	{
+		JsonParser jp;
+		char *data = readTestData("test3e.json");
+		size_t dataLen = strlen(data);
+
+		// Adding one byte at a time grows the buffer geometrically
+		size_t reallocations = 0;
+		size_t lastBufferLen = 0;
+		for(size_t ii = 0; ii < dataLen; ii++) {
+			assert(jp.addData(&data[ii], 1));
+			if (jp.getBufferLen() != lastBufferLen) {
+				assert(jp.getBufferLen() >= 2 * lastBufferLen);
+				lastBufferLen = jp.getBufferLen();
+				reallocations++;
+			}
+		}
+		assert(reallocations <= 8);
+		assert(jp.getBufferLen() < 2 * dataLen);
+		assert(jp.parse());
+		assert(strncmp(jp.getBuffer(), data, dataLen) == 0);
+
+		jp.shrinkToFit();
+		assert(jp.getBufferLen() == dataLen + 1);
+		assert(jp.parse());
+
+		// reserve never shrinks
+		assert(jp.reserve(100));
+		assert(jp.getBufferLen() == dataLen + 1);
+		assert(jp.reserve(10000));
+		assert(jp.getBufferLen() == 10000);
+		assert(strncmp(jp.getBuffer(), data, dataLen) == 0);
+
+		// The buffer grows up to the maximum, but not past it
+		JsonParser jp2;
+		jp2.setMaxBufferLen(100);
+		for(size_t ii = 0; ii < 100; ii++) {
+			assert(jp2.addData(" ", 1));
+		}
+		assert(jp2.getBufferLen() == 100);
+		assert(!jp2.addData(" ", 1));
+		assert(!jp2.reserve(101));
+		assert(jp2.getOffset() == 100);
+
+		// Static buffers are never reallocated
+		JsonParserStatic<16, 4> jp3;
+		assert(jp3.reserve(16));
+		assert(!jp3.reserve(17));
+		jp3.shrinkToFit();
+		assert(jp3.getBufferLen() == 16);
+
+		free(data);
+	}
 
 
 	// Writer test, unallocated buffer
@@ -1114,6 +1979,123 @@ int main(int argc, char *argv[]) {
 		jw.addString("abcdefgh");
 		assertJsonWriterBuffer(jw, "abcdefgh");
 	}
+	// Writer test, dynamically allocated buffer grows as needed
+	{
+		JsonWriterStatic<1024> expected;
+		writeSinkTestDocument(expected);
+
+		JsonWriter jw;
+		writeSinkTestDocument(jw);
+		assert(!jw.isTruncated());
+		assert(jw.getOffset() == expected.getOffset());
+		assert(jw.getBufferLen() < 2 * expected.getOffset() + JsonBuffer::MIN_HEAP_BUFFER);
+		assert(strcmp(jw.getBuffer(), expected.getBuffer()) == 0);
+
+		// Formatted output larger than the buffer
+		JsonWriter jw2;
+		jw2.startArray();
+		jw2.insertCheckSeparator();
+		jw2.insertsprintf("\"%0200d\"", 5);
+		jw2.finishObjectOrArray();
+		assert(!jw2.isTruncated());
+		assert(jw2.getOffset() == 204);
+		assert(jw2.getBuffer()[202] == '"' && jw2.getBuffer()[203] == ']' && jw2.getBuffer()[204] == 0);
+
+		// Limited size
+		JsonWriter jw3;
+		jw3.setMaxBufferLen(100);
+		writeSinkTestDocument(jw3);
+		assert(jw3.isTruncated());
+		assert(jw3.getOffset() == 100);
+		assert(strncmp(jw3.getBuffer(), expected.getBuffer(), 99) == 0);
+
+		// Finishing with no buffer allocated yet
+		JsonWriter jw4;
+		jw4.finishObjectOrArray();
+		assert(jw4.getOffset() == 0);
+		assert(jw4.getBuffer() && jw4.getBuffer()[0] == 0);
+	}
+	// Writer test, checkpoint and rollback to fill a buffer
+	{
+		JsonWriterStatic<48> jw;
+		jw.startObject();
+		jw.insertKeyArray("a");
+
+		int count = 0;
+		for(int ii = 0; ii < 100; ii++) {
+			JsonWriterCheckpoint cp = jw.checkpoint();
+			jw.insertCheckSeparator();
+			jw.insertValue(1000 + ii);
+			if (jw.isTruncated() || jw.getOffset() + jw.getNestingDepth() + 1 > jw.getBufferLen()) {
+				assert(jw.rollback(cp));
+				break;
+			}
+			count++;
+		}
+		assert(jw.getNestingDepth() == 2);
+		jw.finishObjectOrArray();
+		jw.finishObjectOrArray();
+		assert(!jw.isTruncated());
+		assert(jw.getNestingDepth() == 0);
+		assert(count == 8);
+		assertJsonWriterBuffer(jw, "{\"a\":[1000,1001,1002,1003,1004,1005,1006,1007]}");
+
+		// Rolling back nested objects, and the isFirst state of the first element
+		JsonWriterStatic<256> jw2;
+		jw2.startArray();
+		JsonWriterCheckpoint cp = jw2.checkpoint();
+		jw2.startObject();
+		jw2.insertKeyValue("b", 1);
+		assert(jw2.getNestingDepth() == 2);
+		assert(jw2.rollback(cp));
+		assert(jw2.getNestingDepth() == 1);
+		jw2.insertCheckSeparator();
+		jw2.insertValue(2);
+		jw2.finishObjectOrArray();
+		assertJsonWriterBuffer(jw2, "[2]");
+
+		// Rolling back across a finished object and a new array at the same depth
+		JsonWriterStatic<256> jw5;
+		jw5.startArray();
+		jw5.startObject();
+		jw5.insertKeyValue("a", 1);
+		cp = jw5.checkpoint();
+		jw5.finishObjectOrArray();
+		jw5.startArray();
+		jw5.insertArrayValue(2);
+		assert(jw5.rollback(cp));
+		jw5.insertKeyValue("b", 3);
+		jw5.finishObjectOrArray();
+		jw5.finishObjectOrArray();
+		assertJsonWriterBuffer(jw5, "[{\"a\":1,\"b\":3}]");
+
+		// Checkpoints too deep to restore
+		JsonWriter jw6;
+		for(int ii = 0; ii < 32; ii++) {
+			jw6.startArray();
+		}
+		cp = jw6.checkpoint();
+		jw6.insertArrayValue(1);
+		assert(!jw6.rollback(cp));
+
+		// Cannot roll back data that has already been sent to a sink
+		char staging[16];
+		size_t sent = 0;
+		JsonSinkWriter jw3(staging, sizeof(staging), [&sent](const char *data, size_t dataLen) {
+			sent += dataLen;
+			return true;
+		});
+		jw3.startArray();
+		cp = jw3.checkpoint();
+		for(int ii = 0; ii < 10; ii++) {
+			jw3.insertCheckSeparator();
+			jw3.insertValue(ii);
+		}
+		assert(jw3.getFlushedLen() > 0);
+		assert(!jw3.rollback(cp));
+	}
+
+
 	// Writer test, small allocated buffer
 	{
 		JsonWriter jw;
@@ -1161,6 +2143,43 @@ int main(int argc, char *argv[]) {
 
 	}
 
+	// Writer test - control characters, and escapes at every position around the SIMD blocks
+	{
+		JsonWriterStatic<100> jw;
+
+		jw.insertString("a\x01\x1f\x7f", false);
+		assertJsonWriterBuffer(jw, "a\\u0001\\u001F\x7f");
+
+		const char *specials[] = { "\"", "\n", "\xc2\xa2", "\xe2\x82\xac", "\xff" };
+		const char *escaped[] = { "\\\"", "\\n", "\\u00A2", "\\u20AC", "\xff" };
+		for(size_t jj = 0; jj < sizeof(specials) / sizeof(specials[0]); jj++) {
+			for(size_t pos = 0; pos < 40; pos++) {
+				char str[64], expected[64];
+				memset(str, 'x', pos);
+				strcpy(&str[pos], specials[jj]);
+				strcat(str, "yz");
+				memset(expected, 'x', pos);
+				strcpy(&expected[pos], escaped[jj]);
+				strcat(expected, "yz");
+
+				jw.init();
+				jw.insertString(str, false);
+				jw.nullTerminate();
+				assertJsonWriterBuffer(jw, expected);
+				assert(!jw.isTruncated());
+			}
+		}
+
+		// Truncated in the middle of a run and an escape
+		JsonWriterStatic<10> jw2;
+		jw2.insertString("abcdefghijkl");
+		assert(jw2.isTruncated() && jw2.getOffset() == 10 && strncmp(jw2.getBuffer(), "abcdefghij", 10) == 0);
+
+		JsonWriterStatic<10> jw3;
+		jw3.insertString("abcdefg\xe2\x82\xac");
+		assert(jw3.isTruncated() && jw3.getOffset() == 10 && strncmp(jw3.getBuffer(), "abcdefg\\u2", 10) == 0);
+	}
+
 	// Writer test - simple array
 	{
 		JsonWriterStatic<256> jw;
@@ -1259,6 +2278,80 @@ int main(int argc, char *argv[]) {
 
 	}
 
+	// Writer test - nesting depth
+	{
+		// Default static stack allows 8 levels
+		JsonWriterStatic<256> jw;
+		for(int ii = 0; ii < 8; ii++) {
+			assert(jw.startArray());
+		}
+		assert(!jw.isTruncated());
+		assert(!jw.startArray());
+		assert(jw.isTruncated());
+
+		// Smaller static stack
+		JsonWriterStatic<256, 3> jw2;
+		assert(jw2.startObject());
+		jw2.insertKeyArray("a");
+		assert(!jw2.isTruncated());
+		assert(!jw2.startObject());
+		assert(jw2.isTruncated());
+
+		// Larger static stack
+		JsonWriterStatic<256, 20> jw3;
+		for(int ii = 0; ii < 19; ii++) {
+			assert(jw3.startArray());
+		}
+		assert(!jw3.startArray());
+
+		// Static sink and chunked writers
+		JsonSinkWriterStatic<32, 12> jw4([](const char *, size_t) { return true; });
+		JsonChunkedWriterStatic<32, 3> jw5("test", [](const char *, const char *, size_t) { return true; });
+		for(int ii = 0; ii < 11; ii++) {
+			assert(jw4.startArray());
+		}
+		assert(!jw4.startArray());
+		assert(jw5.startArray() && jw5.startArray());
+		assert(!jw5.startArray());
+
+		// The stack size sets the size of the writer
+		assert(sizeof(JsonWriterStatic<256, 2>) < sizeof(JsonWriterStatic<256>));
+		assert(sizeof(JsonWriterStatic<256, 20>) > sizeof(JsonWriterStatic<256>));
+		assert(sizeof(JsonSinkWriterStatic<32, 2>) < sizeof(JsonSinkWriterStatic<32>));
+		assert(sizeof(JsonChunkedWriterStatic<32, 2>) < sizeof(JsonChunkedWriterStatic<32>));
+
+		// Writers with a caller-provided or dynamically allocated buffer allocate a stack with no limit
+		JsonWriterStatic<256> expected;
+		char staging[256];
+		JsonWriter jw6(staging, sizeof(staging));
+		JsonWriter jw7;
+		for(int ii = 0; ii < 50; ii++) {
+			expected.insertChar('[');
+			assert(jw6.startArray());
+			assert(jw7.startArray());
+		}
+		expected.insertChar('1');
+		jw6.insertArrayValue(1);
+		jw7.insertArrayValue(1);
+		for(int ii = 0; ii < 50; ii++) {
+			expected.insertChar(']');
+			jw6.finishObjectOrArray();
+			jw7.finishObjectOrArray();
+		}
+		expected.nullTerminate();
+		assert(!jw6.isTruncated() && !jw7.isTruncated());
+		assert(jw6.getNestingDepth() == 0 && jw7.getNestingDepth() == 0);
+		assertJsonWriterBuffer(jw6, expected.getBuffer());
+		assertJsonWriterBuffer(jw7, expected.getBuffer());
+
+		// A caller-provided stack never uses the heap
+		JsonWriterContext stack[3];
+		JsonWriter jw8(staging, sizeof(staging), stack, 3);
+		assert(jw8.startArray() && jw8.startArray());
+		assert(!jw8.startArray());
+		assert(jw8.isTruncated());
+	}
+
 	// Writer test - float places object
 	{
 		JsonWriterStatic<256> jw;
@@ -1277,6 +2370,322 @@ int main(int argc, char *argv[]) {
 
 	}
 
+	// Writer test - shortest float and double formatting
+	{
+		JsonWriterStatic<64> jw;
+
+		struct {
+			double value;
+			const char *expected;
+		} doubles[] = {
+			{ 0.0, "0" }, { -0.0, "-0" }, { 1.1, "1.1" }, { 100.0, "100" }, { -5.5, "-5.5" }, { 0.1 + 0.2, "0.30000000000000004" },
+			{ 123456.789, "123456.789" }, { 1e21, "1e21" }, { 1e20, "100000000000000000000" }, { 1.5e300, "1.5e300" },
+			{ 1e-6, "0.000001" }, { 1e-7, "1e-7" }, { 1.25e-7, "1.25e-7" }, { 5e-324, "5e-324" },
+			{ 1.7976931348623157e308, "1.7976931348623157e308" }, { NAN, "null" }, { -INFINITY, "null" }
+		};
+		for(size_t ii = 0; ii < sizeof(doubles) / sizeof(doubles[0]); ii++) {
+			jw.init();
+			jw.insertValue(doubles[ii].value);
+			jw.nullTerminate();
+			assertJsonWriterBuffer(jw, doubles[ii].expected);
+		}
+
+		struct {
+			float value;
+			const char *expected;
+		} floats[] = {
+			{ 0.1f, "0.1" }, { 1.1f, "1.1" }, { 3.4028235e38f, "3.4028235e38" }, { 1e-45f, "1e-45" }, { 16777216.0f, "16777216" },
+			{ -2.5f, "-2.5" }, { INFINITY, "null" }
+		};
+		for(size_t ii = 0; ii < sizeof(floats) / sizeof(floats[0]); ii++) {
+			jw.init();
+			jw.insertValue(floats[ii].value);
+			jw.nullTerminate();
+			assertJsonWriterBuffer(jw, floats[ii].expected);
+		}
+
+		// Random values round trip exactly, and are never longer than the shortest %g
+		srand(1);
+		int numShortest = 0, numTested = 0;
+		for(int ii = 0; ii < 100000; ii++) {
+			uint64_t bits = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+			double doubleValue;
+			memcpy(&doubleValue, &bits, sizeof(doubleValue));
+			if (isnan(doubleValue) || isinf(doubleValue)) {
+				continue;
+			}
+			jw.init();
+			jw.insertValue(doubleValue);
+			jw.nullTerminate();
+			assert(strtod(jw.getBuffer(), 0) == doubleValue);
+			numTested++;
+
+			char tmp[32];
+			int precision;
+			for(precision = 1; precision < 17; precision++) {
+				snprintf(tmp, sizeof(tmp), "%.*g", precision, doubleValue);
+				if (strtod(tmp, 0) == doubleValue) {
+					break;
+				}
+			}
+			// Grisu2 gives the shortest digits for over 99% of values, otherwise at most 17 digits
+			int numDigits = 0, trailingZeros = 0;
+			for(const char *cp = jw.getBuffer(); *cp && *cp != 'e'; cp++) {
+				if (*cp >= '1' && *cp <= '9') {
+					numDigits += trailingZeros + 1;
+					trailingZeros = 0;
+				}
+				else
+				if (*cp == '0' && numDigits > 0) {
+					trailingZeros++;
+				}
+			}
+			assert(numDigits <= 17);
+			if (numDigits <= precision) {
+				numShortest++;
+			}
+
+			float floatValue;
+			uint32_t floatBits = (uint32_t)bits;
+			memcpy(&floatValue, &floatBits, sizeof(floatValue));
+			if (isnan(floatValue) || isinf(floatValue)) {
+				continue;
+			}
+			jw.init();
+			jw.insertValue(floatValue);
+			jw.nullTerminate();
+			assert(strtof(jw.getBuffer(), 0) == floatValue);
+		}
+		assert(numShortest > numTested * 99 / 100);
+
+		// Fixed decimal places match printf, including ties that use the vsnprintf fallback
+		const double fixedValues[] = { 0.125, 0.375, 2.5, -1.005, 12.3333, 1e20, -0.001, 999.9999, 0.0 };
+		for(size_t ii = 0; ii < sizeof(fixedValues) / sizeof(fixedValues[0]); ii++) {
+			for(int places = 0; places < 5; places++) {
+				char expected[64];
+				snprintf(expected, sizeof(expected), "%.*f", places, fixedValues[ii]);
+
+				jw.init();
+				jw.setFloatPlaces(places);
+				jw.insertValue(fixedValues[ii]);
+				jw.nullTerminate();
+				assertJsonWriterBuffer(jw, expected);
+			}
+		}
+
+		// Large values and values next to a tie, for every number of places
+		for(int ii = 0; ii < 200000; ii++) {
+			int places = ii % 10;
+			double value;
+			if (ii == 0) {
+				value = 4599183176381.3330078125;
+				places = 3;
+			}
+			else
+			if (ii % 2) {
+				// Random magnitude up to about 1e15
+				value = (double)(((uint64_t)rand() << 31) ^ (uint64_t)rand()) / (double)(1ULL << (rand() % 50));
+			}
+			else {
+				// A halfway value, plus or minus a few ulps
+				value = ((double)(rand() % 100000000) + 0.5) / pow(10.0, places);
+				uint64_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				bits += (rand() % 7) - 3;
+				memcpy(&value, &bits, sizeof(bits));
+			}
+			if (rand() % 2) {
+				value = -value;
+			}
+			char expected[64];
+			snprintf(expected, sizeof(expected), "%.*f", places, value);
+
+			jw.init();
+			jw.setFloatPlaces(places);
+			jw.insertValue(value);
+			jw.nullTerminate();
+			assertJsonWriterBuffer(jw, expected);
+		}
+		jw.setFloatPlaces(-1);
+
+		// Truncated
+		JsonWriterStatic<8> jw2;
+		jw2.insertValue(0.1 + 0.2);
+		assert(jw2.isTruncated());
+		assert(jw2.getOffset() == 8);
+	}
+
+	// Writer test - integer formatting
+	{
+		JsonWriterStatic<32> jw;
+		char expected[32];
+
+		const long long values[] = { 0, 1, -1, 9, 10, -10, 99, 100, 12345, INT_MAX, INT_MIN, 4294967295LL, 4294967296LL, -4294967296LL,
+				10000000000LL, 123456789012345678LL, LLONG_MAX, LLONG_MIN };
+		for(size_t ii = 0; ii < sizeof(values) / sizeof(values[0]); ii++) {
+			jw.init();
+			jw.insertValue(values[ii]);
+			jw.nullTerminate();
+			snprintf(expected, sizeof(expected), "%lld", values[ii]);
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((int64_t)values[ii]);
+			jw.nullTerminate();
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((unsigned long long)values[ii]);
+			jw.nullTerminate();
+			snprintf(expected, sizeof(expected), "%llu", (unsigned long long)values[ii]);
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((uint64_t)values[ii]);
+			jw.nullTerminate();
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((int)values[ii]);
+			jw.nullTerminate();
+			snprintf(expected, sizeof(expected), "%d", (int)values[ii]);
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((unsigned int)values[ii]);
+			jw.nullTerminate();
+			snprintf(expected, sizeof(expected), "%u", (unsigned int)values[ii]);
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((long)values[ii]);
+			jw.nullTerminate();
+			snprintf(expected, sizeof(expected), "%ld", (long)values[ii]);
+			assertJsonWriterBuffer(jw, expected);
+
+			jw.init();
+			jw.insertValue((unsigned long)values[ii]);
+			jw.nullTerminate();
+			snprintf(expected, sizeof(expected), "%lu", (unsigned long)values[ii]);
+			assertJsonWriterBuffer(jw, expected);
+		}
+
+		jw.init();
+		jw.startArray();
+		jw.insertArrayValue((int64_t)-5);
+		jw.insertArrayValue((uint64_t)18446744073709551615ULL);
+		jw.finishObjectOrArray();
+		assertJsonWriterBuffer(jw, "[-5,18446744073709551615]");
+
+		// Truncated
+		JsonWriterStatic<4> jw2;
+		jw2.insertValue(-12345);
+		assert(jw2.isTruncated());
+		assert(jw2.getOffset() == 4 && strncmp(jw2.getBuffer(), "-123", 4) == 0);
+	}
+
+	// Sink writer
+	{
+		JsonWriterStatic<1024> expected;
+		writeSinkTestDocument(expected);
+		assert(!expected.isTruncated());
+
+		// Print sink, staging buffer much smaller than the document
+		PrintRecorder recorder;
+		JsonSinkWriterStatic<16> jw(recorder);
+		writeSinkTestDocument(jw);
+		assert(!jw.isTruncated());
+		assert(jw.getOffset() == 0);
+		assert(jw.getFlushedLen() == expected.getOffset());
+		assert(recorder.len == expected.getOffset());
+		assert(memcmp(recorder.output, expected.getBuffer(), recorder.len) == 0);
+		assert(recorder.numWrites >= recorder.len / 16);
+
+		// Function sink that fails after a few writes
+		size_t numCalls = 0;
+		JsonSinkWriterStatic<32> jw2([&](const char *data, size_t dataLen) {
+			return ++numCalls <= 2;
+		});
+		writeSinkTestDocument(jw2);
+		assert(jw2.isTruncated());
+		assert(jw2.getFlushedLen() > 0 && jw2.getFlushedLen() <= 64);
+
+		// Formatted output larger than the staging buffer is truncated rather than allocated
+		recorder.len = 0;
+		JsonSinkWriterStatic<16> jw3(recorder);
+		jw3.startArray();
+		jw3.insertCheckSeparator();
+		jw3.insertsprintf("\"%s\"", "longer than the staging buffer");
+		assert(jw3.isTruncated());
+		assert(recorder.len == 1 && recorder.output[0] == '[');
+
+		// Reuse after init
+		recorder.len = 0;
+		jw.init();
+		writeSinkTestDocument(jw);
+		assert(!jw.isTruncated());
+		assert(jw.getFlushedLen() == expected.getOffset());
+		assert(memcmp(recorder.output, expected.getBuffer(), recorder.len) == 0);
+	}
+
+	// Chunked writer, reassembled with addChunkedData
+	{
+		JsonWriterStatic<1024> expected;
+		writeSinkTestDocument(expected);
+
+		struct {
+			char eventName[80];
+			char data[33];
+		} chunks[32];
+		size_t numChunks = 0;
+
+		JsonChunkedWriterStatic<32> jw("test/chunked", [&](const char *eventName, const char *data, size_t dataLen) {
+			assert(numChunks < 32);
+			assert(strlen(data) == dataLen);
+			snprintf(chunks[numChunks].eventName, sizeof(chunks[numChunks].eventName), "%s", eventName);
+			snprintf(chunks[numChunks].data, sizeof(chunks[numChunks].data), "%s", data);
+			numChunks++;
+			return true;
+		});
+		writeSinkTestDocument(jw);
+		assert(!jw.isTruncated());
+		assert(jw.getNumChunks() == numChunks);
+		assert(numChunks == (expected.getOffset() + 31) / 32);
+		for(size_t ii = 0; ii < numChunks; ii++) {
+			char expectedName[32];
+			snprintf(expectedName, sizeof(expectedName), "test/chunked/%u", (unsigned int)ii);
+			assert(strcmp(chunks[ii].eventName, expectedName) == 0);
+			assert(ii == numChunks - 1 || strlen(chunks[ii].data) == 32);
+		}
+
+		// Reassemble in reverse order
+		JsonParserStatic<1024, 50> jp;
+		for(size_t ii = numChunks; ii-- > 0; ) {
+			assert(jp.addChunkedData(chunks[ii].eventName, chunks[ii].data, 32));
+		}
+		assert(jp.isComplete());
+		assert(jp.parse());
+		assert(jp.getOffset() == expected.getOffset());
+		assert(memcmp(jp.getBuffer(), expected.getBuffer(), expected.getOffset()) == 0);
+		assert(jp.getReference().key("arr").index(19).valueInt() == 19000);
+
+		// Reset through the base class starts again at chunk 0
+		JsonWriter &base = jw;
+		base.init();
+		assert(jw.getNumChunks() == 0);
+		numChunks = 0;
+		writeSinkTestDocument(jw);
+		assert(strcmp(chunks[0].eventName, "test/chunked/0") == 0);
+
+		// Stops if the callback fails
+		JsonChunkedWriterStatic<32> jw2("test/chunked", [&](const char *eventName, const char *data, size_t dataLen) {
+			return strcmp(eventName, "test/chunked/2") != 0;
+		});
+		writeSinkTestDocument(jw2);
+		assert(jw2.isTruncated());
+		assert(jw2.getNumChunks() == 2);
+	}
+
 	// Writer test - int array
 	{
 		JsonWriterStatic<256> jw;
@@ -1991,7 +3400,7 @@ int main(int argc, char *argv[]) {
 		// float
 		mod.insertOrUpdateKeyValue(jp.getOuterObject(), "d", 3.5);
 
-		expected = "{\"a\":999,\"b\":\"x\",\"c\":true,\"d\":3.500000}";
+		expected = "{\"a\":999,\"b\":\"x\",\"c\":true,\"d\":3.5}";
 		assertJsonParserBuffer(jp, expected);
 
 	}
@@ -2011,7 +3420,7 @@ int main(int argc, char *argv[]) {
 		mod.insertOrUpdateKeyValue(jp.getOuterObject(), "t3", -5.5);
 		mod.insertOrUpdateKeyValue(jp.getOuterObject(), "t4", false);
 
-		assertJsonParserBuffer(jp, "{\"t1\":1234,\"t2\":\"testing 2!\",\"t3\":-5.500000,\"t4\":false}");
+		assertJsonParserBuffer(jp, "{\"t1\":1234,\"t2\":\"testing 2!\",\"t3\":-5.5,\"t4\":false}");
 	}
 
 	// High level appendArrayValue API test
@@ -2045,21 +3454,21 @@ int main(int argc, char *argv[]) {
 
 		//printTokens(jp);
 
-		expected = "[1,2,3.500000]";
+		expected = "[1,2,3.5]";
 		assertJsonParserBuffer(jp, expected);
 
 		mod.appendArrayValue(jp.getOuterArray(), (bool)true);
 
 		//printTokens(jp);
 
-		expected = "[1,2,3.500000,true]";
+		expected = "[1,2,3.5,true]";
 		assertJsonParserBuffer(jp, expected);
 
 		mod.appendArrayValue(jp.getOuterArray(), "xxx");
 
 		// printTokens(jp);
 
-		expected = "[1,2,3.500000,true,\"xxx\"]";
+		expected = "[1,2,3.5,true,\"xxx\"]";
 		assertJsonParserBuffer(jp, expected);
 
 	}